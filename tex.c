@@ -1,3 +1,12 @@
+/**
+ * @brief Define Compiler FLAG
+ * @details Cross-platform compatibility
+ * @note Must precede the headers, otherwise strdup/getline lose their prototypes
+*/
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 /**
  * @brief File Headers
  * @details Terminal, I/O, Error
@@ -14,13 +23,24 @@
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <limits.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define TEX_AVX2 __attribute__((target("avx2"))) // built in, used if the CPU has it
+#endif
 
 /**
  * @brief Define Buffer
  * @details For input Keystroke
 */
 #define CTRL_KEY(k) ( k & 0x1f )
-#define BUF_INIT {NULL, 0}
+#define BUF_INIT {NULL, 0, 0}
+#define BUF_MIN 256
 
 /**
  * @brief Define relevant params
@@ -30,29 +50,378 @@
 #define TEx_VERSION_LAYOUT 3
 #define TABS_TO_SPACES 8
 #define FORCE_QUIT 2
+#define ROW_GAP_MIN 64
+#define ROW_SLACK 16
+#define INPUT_RING_SZ 65536 // power of two
+#define ESC_WAIT_MS 50
+#define FRAME_MIN_MS 16 // redraw rate cap, ~60 fps
+#define FRAME_MAX_MS 100 // draw even under a steady input stream
+#define SAVE_IOV 1024 // iovecs per writev(), within IOV_MAX
+#define SAVE_TICK_MS 100
+#define VIEW_CKPT_MAX 4096 // checkpoints kept by the viewer, stride doubles when full
+#define VIEW_STRIDE_MIN 64
+#define VIEW_SLOTS 4
+#define VIEW_POLL_MS 20 // indexing done per idle tick while line numbers are unknown
+#define FIND_CHUNK 4096 // rows handed to a search worker at a time
+#define FIND_THREADS_MAX 64
+#define REGEX_DFA_MAX 512 // cached DFA states per thread, flushed when full
+#define UNDO_LIMIT (64LL << 20) // undo log budget in bytes, TEX_UNDO_LIMIT overrides
+#define UNDO_SPAN_GAP (2 * (int) sizeof(struct undoOp)) // replace-all: gap cheaper to log than an entry pair
+#define ROW_CHUNK (64 << 10) // rows longer than this keep their index per chunk
+#define SYN_NUMBERS (1 << 0)
+#define SYN_STRINGS (1 << 1)
+#define SYN_MLSTRINGS (1 << 2) // strings may run over rows
+#define SYN_VARS (1 << 3) // $name, ${name}
+#define SYN_KEYS (1 << 4) // key = value, [section]
+#define SYN_PREPROC (1 << 5) // #directive rows
 
 /**
- * @brief Define Compiler FLAG
- * @details Cross-platform compatibility
-*/
-#define _DEFAULT_SOURCE
-#define _BSD_SOURCE
-#define _GNU_SOURCE
+ * @brief Row Index
+ * @details One char that is not a plain byte: a tab or a UTF-8 sequence
+ * @note Bytes between two marks are sent as they are, one column each
+ */
+struct rowMark {
+    int at; // byte just past the char
+    int col; // column just past the char
+};
+
+/**
+ * @brief Terminal Struct
+ * @details Row state few rows need, kept out of the row table
+ * @note Allocated on first use, see editorRowExt
+ * @note snap: save generation the chars were handed to, see editorRowShared
+ */
+struct rowExt {
+    struct rowMark *mark; // see editorRowIndex
+    int n_mark;
+    int mark_cap;
+    struct rowChunks *chunks; // rows over ROW_CHUNK bytes index these instead of marks
+    unsigned int snap;
+};
 
 /**
  * @brief Terminal Struct
  * @details Line Data Structure
+ * @note cap == 0: chars borrowed from the file mapping (no NUL), copied on first edit
+ * @note Nothing is rendered ahead: texDrawLine expands the visible slice from chars
+ * @note A plain ASCII row, indexed or not, has no ext
  */
 typedef struct erow {
     int size;
-    int ren_sz;
+    int cap;
     char *chars;
-    char *render;
+    struct rowExt *ext; // NULL: no marks, chunks or snapshot
+    unsigned char hl_state; // state at the end of the row, see editorHlSync
+    unsigned char indexed; // see editorRowIndex
 } erow;
 
+#define ROW_CHUNKS(row) ((row)->ext ? (row)->ext->chunks : NULL)
+
+/**
+ * @brief Row Gap
+ * @details Gap buffer in the chars of the long row being typed into
+ * @note chars hold bytes [0, at), len free bytes, then [at, size); row == NULL: none
+ * @note Only chunked rows get one, and only one at a time, see editorGapKeeps
+ */
+struct rowGap {
+    erow *row;
+    int at;
+    int len;
+};
+
+/**
+ * @brief Input Ring Buffer
+ * @details Raw bytes read from the terminal, not yet decoded into keys
+ * @note head/tail run freely, masked on access
+ */
+struct inputRing {
+    unsigned char b[INPUT_RING_SZ];
+    unsigned int head;
+    unsigned int tail;
+};
+
+/**
+ * @brief Background Save
+ * @details Snapshot of row pointers streamed to disk by the writer thread
+ * @note Shared chars are never modified or freed while active, see garbage
+ */
+struct saveJob {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    int active;
+    int finished; // lock
+    int err; // lock
+    long long done; // lock
+    long long total;
+    unsigned int gen;
+    int mod;
+    int atomic;
+    mode_t mode;
+    long long sync_ms;
+    char *file_name;
+    char *target;
+    struct iovec *rows;
+    int n_rows;
+    char **garbage;
+    int n_garbage;
+    int garbage_cap;
+};
+
+/**
+ * @brief Read-only Viewer
+ * @details Sparse line index over the file mapping, see editorViewOpen
+ * @note ckpt[k]: offset of line k * stride; memory is fixed whatever the file size
+ * @note floating: rows are win[] (line starts past the index), numbered from
+ *       the window top until the index reaches win[0], see editorViewSeek
+ */
+struct viewIndex {
+    size_t ckpt[VIEW_CKPT_MAX];
+    int n_ckpt;
+    int stride;
+    int done;
+    size_t scan;
+    int lines; // lines indexed
+    int floating;
+    size_t *win;
+    int win_n;
+    int win_cap;
+    int win_eof;
+    int cur_line;
+    size_t cur_off;
+    erow slot[VIEW_SLOTS];
+    int slot_line[VIEW_SLOTS];
+    int next_slot;
+};
+
+/**
+ * @brief Regex
+ * @details Thompson NFA of the reversed pattern, see regexCompile
+ */
+enum reType {
+    RE_CHAR = 0,
+    RE_SPLIT,
+    RE_EPS,
+    RE_MATCH
+};
+
+struct reState {
+    int type;
+    int out1;
+    int out2;
+    unsigned char cls[32]; // RE_CHAR: byte set
+};
+
+struct regex {
+    struct reState *st;
+    int n_st;
+    int st_cap;
+    int start;
+    int bol; // ^
+    int eol; // $
+    unsigned int id;
+};
+
+/**
+ * @brief Regex
+ * @details Lazily built DFA over a struct regex, one per thread
+ * @note A state is a sorted set of NFA states; next[] is filled on first use
+ */
+struct reDfaState {
+    int *set;
+    int n;
+    int match;
+    int next[256];
+};
+
+struct regexDfa {
+    unsigned int id; // regex it was built for
+    struct reDfaState *s;
+    int n;
+    int flushes;
+    int *hash;
+    int *mark;
+    int stamp;
+    int *stack;
+    int *buf;
+    int n_buf;
+    int alloc;
+};
+
+/**
+ * @brief Search State
+ * @details Incremental search, see editorFind
+ */
+struct findState {
+    int orig_y;
+    int orig_x;
+    int orig_off_row;
+    int orig_off_col;
+    int last_y; // -1: restart from orig
+    int last_x;
+    int regex; // Ctrl-T in the prompt
+    int re_ok;
+    struct regex re;
+    struct regexDfa dfa;
+    char prompt[64];
+};
+
+/**
+ * @brief Search Pool
+ * @details Parallel whole-buffer search, see editorSearchStart
+ * @note chunk[k] covers rows [k * FIND_CHUNK, (k + 1) * FIND_CHUNK); workers
+ *       take chunks from the cursor onwards, a chunk's matches are read
+ *       only once it is done
+ */
+struct findMatch {
+    int y;
+    int x;
+};
+
+struct findChunk {
+    struct findMatch *m;
+    int n;
+    int cap;
+    int done; // lock
+};
+
+struct searchPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int n_threads; // 0: not started, -1: unavailable
+    unsigned int gen; // lock, atomic reads from workers
+    int busy; // lock
+    char *q;
+    int q_len;
+    struct regex *re; // NULL: plain substring
+    struct findChunk *chunk;
+    int n_chunks; // lock
+    int chunk_cap;
+    int start;
+    int next; // lock
+    int n_done; // lock
+    struct findMatch *match; // merged, sorted by (y, x)
+    int n_match;
+    int match_cap;
+    int merged;
+};
+
+/**
+ * @brief Undo Log
+ * @details Edits as text inserted / deleted at a position, see editorUndoRecord
+ * @note A row split or join is the insert / delete of a "\n"; entries of one
+ *       command share a group; op[first, pos) can be undone, op[pos, n) redone
+ */
+enum undoType {
+    UNDO_INS = 0,
+    UNDO_DEL,
+    UNDO_ROW_INS // a row appended past the end, which no text position covers
+};
+
+struct undoOp {
+    int type;
+    unsigned int group;
+    int y;
+    int x;
+    int len;
+    int cap;
+    char *text;
+    int after_y; // cursor once its command was done, -1: not known yet
+    int after_x;
+};
+
+struct undoLog {
+    struct undoOp *op;
+    int first;
+    int pos;
+    int n;
+    int cap;
+    unsigned int group;
+    int open; // typing keeps adding to the open group
+    int kind; // last key: 0 command, 1 typing, 2 deleting
+    int logged; // the last key logged an edit, its cursor is still to be kept
+    int replay;
+    int overflow;
+    long long bytes;
+    long long limit;
+};
+
+/**
+ * @brief Syntax Highlighting
+ * @details Colour classes and the states carried from one row to the next
+ */
+enum hlType {
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_KEYWORD,
+    HL_TYPE,
+    HL_STRING,
+    HL_NUMBER,
+    HL_SPECIAL
+};
+
+enum hlState {
+    HS_NONE = 0,
+    HS_COMMENT,
+    HS_DQUOTE,
+    HS_SQUOTE
+};
+
+struct editorSyntax {
+    const char *name;
+    const char **match; // ".ext" or a file name
+    const char **keywords; // trailing '|': a type
+    const char *line_comment;
+    const char *block_start;
+    const char *block_end;
+    int flags;
+};
+
+/**
+ * @brief Syntax Highlighting
+ * @details Scanner state between two bytes of a row, see editorHlRun
+ * @note over: bytes past the slice the last token already took, coloured prev_hl
+ */
+struct hlRun {
+    unsigned char in_comment;
+    unsigned char in_str;
+    unsigned char in_key;
+    unsigned char in_pre;
+    unsigned char in_line; // line comment, to the end of the row
+    unsigned char lead; // leading blanks of the row not passed yet
+    unsigned char prev_sep;
+    unsigned char prev_hl;
+    int over;
+};
+
+/**
+ * @brief Row Chunks
+ * @details Index of a long row, one entry per slice of about ROW_CHUNK bytes
+ * @note Columns are relative, so an edit redoes its own chunk only: a chunk
+ *       starting at column c ends at c + pre, or with a tab at the tab stop
+ *       after c + pre, plus rest
+ * @note hl: scanner state at the chunk start, see editorHlRow
+ */
+struct rowChunk {
+    int len;
+    int pre; // columns before the first tab, all of them without one
+    int rest; // columns after the first tab
+    int tab;
+    struct hlRun hl;
+};
+
+struct rowChunks {
+    int n;
+    int cap;
+    int hl_from; // first chunk to rescan, n when all states hold
+    int hl_to; // last chunk whose bytes changed since
+    struct rowChunk c[];
+};
+
 /**
  * @brief Terminal Struct
  * @details Configuration
+ * @note row is a gap buffer: n_rows live slots of row_cap, free gap sits at gap_at
 */
 struct texConfig {
     int dispRows;
@@ -65,20 +434,52 @@ struct texConfig {
     int off_col;
     int mod;
     char *file_name;
-    char *stt_msg[80];
+    unsigned long frames_drawn;
+    unsigned long frames_skipped;
+    long long frame_time;
+    char stt_msg[80];
     time_t msg_time;
+    int row_cap;
+    int gap_at;
     erow *row;
+    struct rowGap cgap;
+    struct vLine *vscr;
+    struct inputRing in;
+    struct saveJob save;
+    int viewer;
+    struct viewIndex view;
+    struct findState find;
+    struct searchPool search;
+    struct undoLog undo;
+    const struct editorSyntax *syntax;
+    int hl_upto; // rows [0, hl_upto) have a valid hl_state
+    int hl_known; // rows [0, hl_known) have one computed at some point
+    int hl_dirty; // rows [hl_upto, hl_dirty) may have changed since
+    char *map;
+    size_t map_len;
+    size_t load_at; // first line of the mapping not in the row table yet
     struct termios orig_termios;
 };
 struct texConfig conf; // Global scope
 
 /**
  * @brief Define memory struct
- * @details Memory Buffer for input
+ * @details Memory Buffer for input, reset and reused rather than freed
 */
 struct memBuf {
     char *b;
     int len;
+    int cap;
+};
+
+/**
+ * @brief Define virtual screen
+ * @details Last frame emitted, one entry per terminal line
+ * @note len == -1: terminal content unknown, line must be redrawn
+*/
+struct vLine {
+    struct memBuf ln;
+    int rev;
 };
 
 /**
@@ -96,8 +497,82 @@ enum navKey {
     HOME_KEY,
     END_KEY,
     DEL_KEY,
+    PASTE_START,
+    PASTE_END,
+    CTRL_HOME,
+    CTRL_END,
+};
+
+/**
+ * @brief Escape Sequence Table
+ * @details Bytes following <ESC> for each navigation key
+ * @note OSes, Terminal emulators compatibility: several spellings per key
+*/
+static const struct {
+    const char *seq;
+    int key;
+} escKeyTable[] = {
+    {"[A", ARR_UP},
+    {"[B", ARR_DOWN},
+    {"[C", ARR_RIGHT},
+    {"[D", ARR_LEFT},
+    {"[H", HOME_KEY},
+    {"[F", END_KEY},
+    {"[1~", HOME_KEY},
+    {"[3~", DEL_KEY},
+    {"[4~", END_KEY},
+    {"[5~", PAGE_UP},
+    {"[6~", PAGE_DOWN},
+    {"[7~", HOME_KEY},
+    {"[8~", END_KEY},
+    {"OH", HOME_KEY},
+    {"OF", END_KEY},
+    {"[1;5H", CTRL_HOME},
+    {"[1;5F", CTRL_END},
+    {"[7^", CTRL_HOME},
+    {"[8^", CTRL_END},
+    {"[200~", PASTE_START},
+    {"[201~", PASTE_END},
+};
+
+/**
+ * @brief Syntax Highlighting
+ * @details Highlight Database, picked by file name in editorSelectSyntax
+ */
+static const char *C_HL_match[] = {".c", ".h", ".cc", ".cpp", ".hpp", NULL};
+static const char *C_HL_keywords[] = {
+    "switch", "if", "while", "for", "break", "continue", "return", "else",
+    "struct", "union", "typedef", "static", "enum", "case", "default", "do",
+    "goto", "sizeof", "const", "volatile", "extern", "register", "inline",
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", "short|", "size_t|", "ssize_t|", "bool|", NULL
+};
+
+static const char *SH_HL_match[] = {".sh", ".bash", ".zsh", ".bashrc", ".profile", NULL};
+static const char *SH_HL_keywords[] = {
+    "if", "then", "else", "elif", "fi", "case", "esac", "for", "while",
+    "until", "do", "done", "in", "function", "return", "local", "export",
+    "readonly", "shift", "exit", "break", "continue",
+    "echo|", "printf|", "cd|", "test|", "read|", "set|", "unset|",
+    "source|", "eval|", "exec|", "trap|", NULL
+};
+
+static const char *CF_HL_match[] = {".conf", ".cfg", ".ini", ".toml", ".yaml", ".yml", ".env", ".properties", NULL};
+static const char *CF_HL_keywords[] = {
+    "true|", "false|", "yes|", "no|", "on|", "off|", "null|", NULL
+};
+
+static const struct editorSyntax HLDB[] = {
+    {"c", C_HL_match, C_HL_keywords, "//", "/*", "*/",
+     SYN_NUMBERS | SYN_STRINGS | SYN_PREPROC},
+    {"sh", SH_HL_match, SH_HL_keywords, "#", NULL, NULL,
+     SYN_NUMBERS | SYN_STRINGS | SYN_MLSTRINGS | SYN_VARS},
+    {"conf", CF_HL_match, CF_HL_keywords, "#", NULL, NULL,
+     SYN_NUMBERS | SYN_STRINGS | SYN_KEYS},
 };
 
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
 /**
  * @brief Function Prototypes
  * @details TEx general API
@@ -107,15 +582,23 @@ void texRawEnable();
 void texRawDisable();
 void texTerminate(const char *);
 int texReadKey();
+int texInputFill(int );
+int texInputPending();
+int texDecodeKey(int *);
+int texInputWait(int );
+void texReadPaste(struct memBuf *);
 int texGetWindowsSize(int *, int *);
 int texGetCursorPosition(int *, int *);
 void texProcessKey();
 void texNavCursor(int );
 void texDispRefresh();
+void texDispFrame();
 void texDrawLine();
 void texDrawStatusBar(struct memBuf *);
 void texDrawStatusMsg(struct memBuf *);
-char *texUserPrompt(char *);
+void texVScreenPut(struct memBuf *, int , struct memBuf *, int );
+void texVScreenReset();
+char *texUserPrompt(char *, void (*)(char *, int ));
 void texSetStatusMessage(const char *, ...);
 
 /**
@@ -124,20 +607,149 @@ void texSetStatusMessage(const char *, ...);
 */
 void editorOpen(char *);
 void editorSave();
+void *editorSaveWorker(void *);
+int editorSaveStream(struct saveJob *, int );
+void editorSavePoll();
+void editorSaveWait();
+void editorSaveGarbage(char *);
+int editorRowShared(erow *);
 void editorAppendChar(int , char *, size_t );
+void editorAppendMapped(int , char *, size_t );
+void editorLoadTo(int );
+void editorLoadAll();
 void editorAppendString(erow *, char *, size_t );
 void editorInsertNewLine();
+void editorInsertText(char *, int );
 void editorScroll();
+void editorJump(int , int );
+void editorGoto();
 void editorUpdateRow(erow *);
+void editorRowIndex(erow *);
+void editorRowPatch(erow *, int , int );
+void editorChunkBuild(erow *);
+void editorChunkReserve(erow *, int );
+void editorChunkSum(erow *, int , int );
+int editorChunkCol(struct rowChunk *, int );
+int editorChunkFind(erow *, int , int *, int *);
+void editorRowMark(erow *, int , int );
+struct rowExt *editorRowExt(erow *);
+int editorRowPlain(erow *);
 void editorInputChar(int );
 void editorRemoveChar();
 void editorRemoveRow(int );
+void editorRowOwn(erow *);
+erow *editorRowAt(int );
+erow *editorRowSlot(int );
+void editorRowReserve(int );
+void editorRowGapMove(int );
+void editorGapOpen(erow *, int );
+void editorGapMove(erow *, int );
+void editorGapClose();
+int editorGapKeeps(int );
+int editorRowPos(erow *, int );
+char *editorRowTail(erow *, int );
+int editorRowSpans(erow *, int , int , const char **, int *);
+void editorDetachMap();
+int editorReadOnly();
+char *editorRowText(int , int *);
+
+/**
+ * @brief Function Prototypes
+ * @details TEx - Search
+*/
+void editorFind();
+void editorFindCallback(char *, int );
+int editorFindNext(const char *, int , int , int , int , int *, int *);
+int editorSearchPool();
+void editorSearchStart(const char *, int , int , struct regex *);
+void editorSearchCancel();
+void *editorSearchWorker(void *);
+void editorSearchAdd(struct findChunk *, int , int );
+void editorSearchMerge();
+int editorSearchLookup(int , int , int , int *, int *);
+void editorReplace();
+int editorReplaceAll(const char *, int , const char *, int );
+
+/**
+ * @brief Function Prototypes
+ * @details TEx - Undo
+*/
+void editorUndoInit();
+void editorUndoBoundary(int );
+void editorUndoRecord(int , int , int , const char *, int );
+void editorUndoEnd(struct undoOp *, int *, int *);
+void editorUndoText(struct undoOp *, const char *, int , int );
+void editorUndoEvict();
+void editorUndoClear();
+void editorUndo();
+void editorRedo();
+void editorUndoApply(struct undoOp *, int );
+void editorUndoInsert(int , int , const char *, int );
+void editorUndoDelete(int , int , int );
+
+/**
+ * @brief Function Prototypes
+ * @details TEx - Syntax highlighting
+*/
+void editorSelectSyntax();
+unsigned char editorHlScan(const char *, int , unsigned char , unsigned char *);
+void editorHlBegin(struct hlRun *, unsigned char );
+void editorHlRun(struct hlRun *, const char *, int , int , int , unsigned char *);
+unsigned char editorHlEnd(struct hlRun *, const char *, int );
+unsigned char editorHlRow(erow *, unsigned char );
+void editorHlSync(int );
+void editorHlDirty(int );
+void editorHlShift(int , int );
+int editorHlColor(int );
+
+/**
+ * @brief Function Prototypes
+ * @details TEx - Regex
+*/
+int regexCompile(struct regex *, const char *);
+int regexNew(struct regex *, int );
+void regexPatch(struct regex *, int , int );
+int regexJoin(struct regex *, int , int );
+int regexAlt(struct regex *, const char **, const char *, int *);
+int regexCat(struct regex *, const char **, const char *, int *);
+int regexRepeat(struct regex *, const char **, const char *, int *);
+int regexAtom(struct regex *, const char **, const char *, int *);
+int regexEscape(unsigned char *, int );
+int regexClass(unsigned char *, const char **, const char *);
+void regexDfaReset(struct regexDfa *, struct regex *);
+void regexClosure(struct regexDfa *, struct regex *, int );
+int regexDfaAdd(struct regexDfa *, struct regex *);
+int regexDfaNext(struct regexDfa *, struct regex *, int , unsigned char );
+int regexStarts(struct regex *, struct regexDfa *, const char *, int , int **, int *);
+
+/**
+ * @brief Function Prototypes
+ * @details TEx - Read-only viewer
+*/
+void editorViewOpen(char *);
+void editorViewIndex(int );
+void editorViewStep();
+void editorViewAll();
+int editorViewLineOf(size_t );
+size_t editorViewResync(size_t );
+void editorViewSeek(size_t , int );
+void editorViewGrow(int );
+void editorViewBack(int );
+void editorViewSettle();
+void editorViewDrop(int );
+void editorViewPoll();
+void editorViewForget();
+size_t editorViewLine(int , int *);
+erow *editorViewRow(int );
 
 /**
  * @brief Function Prototypes
  * @details TEx - Memory control
 */
 void memBufAppend(struct memBuf *, const char *, int );
+void memBufRepeat(struct memBuf *, char , int );
+int memBufReserve(struct memBuf *, int );
+void memBufReset(struct memBuf *);
 void memBufFree(struct memBuf *);
 void memFreeRow(erow *);
 
@@ -146,9 +758,23 @@ void memFreeRow(erow *);
  * @details TEx - Miscellaneous Utilities
 */
 int utilCur2Ren(erow *, int );
+int utilRen2Cur(erow *, int );
+int utilColAdvance(const char *, int , int );
+int utilColSeek(const char *, int , int , int );
 void utilCharInsert(erow *, int , int );
-void utilCharDel(erow *, int );
-char *utilRow2Str(int *);
+void utilCharDel(erow *, int , int );
+int utilIsAscii(const char *, int );
+int utilUtf8Decode(const char *, int , int *);
+int utilUtf8Prev(const char *, int );
+int utilCharNext(const char *, int , int , int *);
+int utilCharWidth(int );
+void utilRowReserve(erow *, int );
+long long utilClockMs();
+const char *utilMemMem(const char *, size_t , const char *, size_t );
+#if defined(__SSE2__)
+const char *utilMemMemAvx2(const char *, size_t , const char *, size_t , size_t *);
+#endif
+int utilWritevAll(int , struct iovec *, int );
 
 
 /**
@@ -159,15 +785,36 @@ int main(int argc, char const *argv[]){
 
     texRawEnable();
     texDispInit();
-    if (argc >= 2)
+    if (argc >= 3 && strcmp(argv[1], "-R") == 0)
+    {
+        editorViewOpen( (char *) argv[2]);
+    }
+    else if (argc >= 2)
     {
         editorOpen( (char *) argv[1]);
     }
 
-    texSetStatusMessage("HELP: Ctrl-S to save | Ctrl-Q to quit");
+    texSetStatusMessage("HELP: Ctrl-S to save | Ctrl-Q to quit | Ctrl-F to find | Ctrl-R to replace");
 
     while(1){
-        texDispRefresh();
+        editorSavePoll();
+        texDispFrame();
+
+        if (conf.save.active && !texInputWait(SAVE_TICK_MS))
+        {
+            continue; // idle tick, keeps the save progress moving on screen
+        }
+        if (conf.view.floating)
+        {
+            // idle: index on, no redraw until a key comes or the line numbers do
+            while (conf.view.floating && !texInputWait(0)) {
+                editorViewPoll();
+            }
+            if (!texInputWait(0))
+            {
+                continue; // settled, draw the numbers
+            }
+        }
         texProcessKey();
     }
 
@@ -184,12 +831,50 @@ void texDispInit(){
     conf.ren_x = 0;
     conf.n_rows = 0;
     conf.row = NULL;
+    conf.vscr = NULL;
+    conf.row_cap = 0;
+    conf.gap_at = 0;
+    conf.cgap.row = NULL;
+    conf.map = NULL;
+    conf.map_len = 0;
+    conf.load_at = 0;
     conf.file_name = NULL;
     conf.off_row = 0;
     conf.off_col = 0;
     conf.stt_msg[0] = '\0';
     conf.msg_time = 0;
     conf.mod = 0;
+    conf.frames_drawn = 0;
+    conf.frames_skipped = 0;
+    conf.frame_time = 0;
+    conf.save.active = 0;
+    conf.save.gen = 0;
+    pthread_mutex_init(&conf.save.lock, NULL);
+    editorUndoInit();
+    conf.syntax = NULL;
+    conf.hl_upto = 0;
+    conf.hl_known = 0;
+    conf.hl_dirty = 0;
+    conf.search.n_threads = 0;
+    conf.search.gen = 0;
+    conf.search.busy = 0;
+    conf.search.q = NULL;
+    conf.search.re = NULL;
+    conf.find.regex = 0;
+    conf.find.re.st = NULL;
+    conf.find.re.n_st = 0;
+    conf.find.re.st_cap = 0;
+    conf.find.re.id = 0;
+    memset(&conf.find.dfa, 0, sizeof(conf.find.dfa));
+    conf.search.chunk = NULL;
+    conf.search.n_chunks = 0;
+    conf.search.chunk_cap = 0;
+    conf.search.match = NULL;
+    conf.search.n_match = 0;
+    conf.search.match_cap = 0;
+    pthread_mutex_init(&conf.search.lock, NULL);
+    pthread_cond_init(&conf.search.work, NULL);
+    pthread_cond_init(&conf.search.done, NULL);
 
     if (texGetWindowsSize(&conf.dispRows, &conf.dispCols) == -1)
     {
@@ -197,6 +882,7 @@ void texDispInit(){
     }
 
     conf.dispRows -= 2;
+    texVScreenReset();
 }
 
 /**
@@ -226,6 +912,9 @@ void texRawEnable() {
     {
         texTerminate("tcsetattr");
     }
+
+    // bracketed paste: terminal wraps pasted text in <ESC>[200~ ... <ESC>[201~
+    write(STDIN_FILENO, "\x1b[?2004h", 8);
 }
 
 /**
@@ -234,6 +923,7 @@ void texRawEnable() {
  */
 void texRawDisable() {
   // tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+  write(STDIN_FILENO, "\x1b[?2004l", 8);
 
   if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &conf.orig_termios) == -1)
   {
@@ -257,87 +947,238 @@ void texTerminate(const char *s){
 
 /**
  * @brief Terminal API
- * @details Read Input
- * @return Byte char
+ * @details Read Input, one key decoded from the input ring
+ * @return Byte char or navKey
  */ 
 int texReadKey(){
-    int nChar;
-    char c;
-    while( (nChar = read(STDIN_FILENO, &c, 1) ) != 1 ){
-        if (nChar == -1 && errno != EAGAIN) // Again, Cygwin compatibility
-        {//
-            texTerminate("read");
+    while (1) {
+        if (!texInputPending())
+        {
+            texInputFill(1);
+            continue;
+        }
+
+        int key;
+        int used = texDecodeKey(&key);
+
+        if (used > 0)
+        {
+            conf.in.head += used;
+            return key;
+        }
+
+        // partial sequence stays queued, resume once the rest arrives
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, ESC_WAIT_MS) <= 0 || texInputFill(0) == 0)
+        {
+            conf.in.head++;
+            return '\x1b';
         }
     }
+}
+
+/**
+ * @brief Terminal API
+ * @details Read all available bytes into the input ring in one call
+ * 
+ * @param block Wait for at least one byte
+ * @return Bytes read
+ */
+int texInputFill(int block){
+    struct inputRing *in = &conf.in;
+    unsigned int used = in->tail - in->head;
+    unsigned int at = in->tail & (INPUT_RING_SZ - 1);
+    unsigned int room = INPUT_RING_SZ - used;
+
+    if (room == 0)
+    {
+        return 0;
+    }
+    if (room > INPUT_RING_SZ - at)
+    {
+        room = INPUT_RING_SZ - at;
+    }
 
-    if (c == '\x1b')
+    if (!block)
     {
-        char kNav[3];
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, 0) <= 0)
+        {
+            return 0;
+        }
+    }
 
-        if (read(STDIN_FILENO, &kNav[0], 1) != 1)
+    int nRead;
+    while ((nRead = read(STDIN_FILENO, &in->b[at], room)) <= 0) {
+        if (nRead == -1 && errno != EAGAIN && errno != EINTR) // Again, Cygwin compatibility
         {
-            return '\x1b';
+            texTerminate("read");
         }
-        if (read(STDIN_FILENO, &kNav[1], 1) != 1)
+        if (!block)
         {
-            return '\x1b';
+            return 0;
+        }
+    }
+
+    in->tail += nRead;
+    return nRead;
+}
+
+/**
+ * @brief Terminal API
+ * @details Queued, undecoded input
+ * @return Bytes waiting in the input ring
+ */
+int texInputPending(){
+    return conf.in.tail - conf.in.head;
+}
+
+/**
+ * @brief Terminal API
+ * @details Wait for input without consuming it
+ * 
+ * @param ms Timeout
+ * @return Input available: 1/0
+ */
+int texInputWait(int ms){
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return texInputPending() || poll(&pfd, 1, ms) > 0;
+}
+
+/**
+ * @brief Terminal API
+ * @details Decode the key at the head of the input ring via escKeyTable
+ * 
+ * @param key Decoded key
+ * @return Bytes consumed, 0 when a sequence is still incomplete
+ */
+int texDecodeKey(int *key){
+    struct inputRing *in = &conf.in;
+    int avail = texInputPending();
+    unsigned int mask = INPUT_RING_SZ - 1;
+
+    *key = in->b[in->head & mask];
+    if (*key != '\x1b')
+    {
+        return 1;
+    }
+    if (avail == 1)
+    {
+        return 0;
+    }
+
+    int partial = 0;
+    size_t i;
+    for (i = 0; i < sizeof(escKeyTable) / sizeof(escKeyTable[0]); ++i)
+    {
+        const char *seq = escKeyTable[i].seq;
+        int j;
+
+        for (j = 0; seq[j] && j + 1 < avail; ++j)
+        {
+            if (in->b[(in->head + j + 1) & mask] != (unsigned char) seq[j])
+            {
+                break;
+            }
         }
 
-        if (kNav[0] == '[')
+        if (seq[j] == '\0')
         {
+            *key = escKeyTable[i].key;
+            return j + 1;
+        }
+        if (j + 1 == avail)
+        {
+            partial = 1;
+        }
+    }
 
-            if (kNav[1] >= '0' && kNav[1] <= '9')
+    if (in->b[(in->head + 1) & mask] == '[')
+    {
+        // unknown CSI: swallow up to its final byte
+        int j;
+        for (j = 2; j < avail; ++j)
+        {
+            unsigned char c = in->b[(in->head + j) & mask];
+            if (c >= 0x40 && c <= 0x7e)
             {
-                if (read(STDIN_FILENO, &kNav[2], 1) != 1)
-                {
-                    return '\x1b';
-                }
+                return j + 1;
+            }
+        }
+        return 0;
+    }
 
-                if (kNav[2] == '~')
-                {
-                    switch(kNav[1]){
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-
-                        /* 
-                            NOTE: OSes, Terminal emulators compatibility
-                        */
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
-                    }
-                }
+    return partial ? 0 : 2;
+}
+
+/**
+ * @brief Terminal API
+ * @details Collect a bracketed paste payload straight from the input ring
+ * @note Called after PASTE_START, stops at (and drops) <ESC>[201~
+ * 
+ * @param paste Buffer receiving the raw pasted bytes
+ */
+void texReadPaste(struct memBuf *paste){
+    static const char end_seq[] = "\x1b[201~";
+    int end_len = sizeof(end_seq) - 1;
+    struct inputRing *in = &conf.in;
+    unsigned int mask = INPUT_RING_SZ - 1;
+
+    memBufReset(paste);
+
+    while (1) {
+        if (!texInputPending())
+        {
+            texInputFill(1);
+        }
+
+        unsigned int at = in->head & mask;
+        int span = texInputPending();
+        if (span > INPUT_RING_SZ - (int) at)
+        {
+            span = INPUT_RING_SZ - at;
+        }
+
+        unsigned char *esc = memchr(&in->b[at], '\x1b', span);
+        int run = esc ? esc - &in->b[at] : span;
+
+        memBufAppend(paste, (char *) &in->b[at], run);
+        in->head += run;
+
+        if (esc == NULL)
+        {
+            continue;
+        }
+
+        if (texInputPending() < end_len)
+        {
+            if (texInputFill(1) == 0)
+            {
+                continue;
             }
-            else {
-                switch(kNav[1]){
-                    case 'A':
-                        return ARR_UP;
-                    case 'B':
-                        return ARR_DOWN;
-                    case 'D':
-                        return ARR_LEFT;
-                    case 'C':
-                        return ARR_RIGHT;
-                    case 'H':
-                        return HOME_KEY;
-                    case 'F':
-                        return END_KEY;
-                }
+            if (texInputPending() < end_len)
+            {
+                continue;
             }
         }
-        else if (kNav[0] == 'O') {
-            switch (kNav[1]){
-                case 'H': return HOME_KEY;
-                case 'F': return END_KEY;
+
+        int j;
+        for (j = 0; j < end_len; ++j)
+        {
+            if (in->b[(in->head + j) & mask] != (unsigned char) end_seq[j])
+            {
+                break;
             }
         }
 
-        return '\x1b';
-    }
-    else {
-        return c;
+        if (j == end_len)
+        {
+            in->head += end_len;
+            return;
+        }
+
+        memBufAppend(paste, "\x1b", 1);
+        in->head++;
     }
 }
 
@@ -422,8 +1263,15 @@ void texProcessKey(){
     static int confirm_exit = FORCE_QUIT;
     int c = texReadKey();
 
-    switch(c){
+    editorUndoBoundary(c);
+    if (!editorGapKeeps(c))
+    {
+        editorGapClose();
+    }
+
+    switch(c){
         case CTRL_KEY('q'):
+            editorSaveWait();
             if (conf.mod && confirm_exit > 0)
             {
                 texSetStatusMessage("WARNING ! File has unsaved changes. Press Ctrl-Q again (%d) to confirm quit", confirm_exit);
@@ -441,6 +1289,33 @@ void texProcessKey(){
             editorSave();
             break;
 
+        case CTRL_KEY('f'):
+            editorFind();
+            break;
+
+        case CTRL_KEY('r'):
+            editorReplace();
+            break;
+
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
+
+        case PASTE_START:
+            {
+                static struct memBuf paste = BUF_INIT;
+                texReadPaste(&paste);
+                editorInsertText(paste.b, paste.len);
+            }
+            break;
+
+        case PASTE_END:
+            break;
+
         case ARR_UP:
         case ARR_DOWN:
         case ARR_LEFT:
@@ -449,25 +1324,38 @@ void texProcessKey(){
             break;
 
         case PAGE_UP:
+            // the top line moves to the bottom, or the bottom one to the top
+            editorJump(conf.off_row - (conf.dispRows - 1), 0);
+            break;
+
         case PAGE_DOWN:
+            editorJump(conf.off_row + 2 * (conf.dispRows - 1), conf.dispRows - 1);
+            break;
+
+        case CTRL_HOME:
+            if (conf.view.floating)
             {
-                if (c == PAGE_UP)
-                {
-                    conf.cur_y = conf.off_row;
-                }
-                else if (c == PAGE_DOWN) {
-                    conf.cur_y = conf.off_row + conf.dispRows - 1;
-                    if (conf.cur_y > conf.n_rows)
-                    {
-                        conf.cur_y = conf.n_rows;
-                    }
-                }
+                editorViewDrop(-1);
+            }
+            editorJump(0, 0);
+            conf.cur_x = 0;
+            break;
 
-                int times = conf.dispRows;
-                while (--times){
-                    texNavCursor(c == PAGE_UP ? ARR_UP : ARR_DOWN);
-                }
+        case CTRL_END:
+            if (conf.viewer && !conf.view.done)
+            {
+                // the last line is found from the end, not by indexing to it
+                editorViewSeek(editorViewResync(conf.map_len), conf.dispRows - 1);
+            }
+            else {
+                editorLoadAll();
+                editorJump(conf.n_rows - 1, conf.dispRows - 1);
             }
+            conf.cur_x = conf.cur_y < conf.n_rows ? editorRowAt(conf.cur_y)->size : 0;
+            break;
+
+        case CTRL_KEY('g'):
+            editorGoto();
             break;
 
         case HOME_KEY:
@@ -477,7 +1365,7 @@ void texProcessKey(){
         case END_KEY:
             if (conf.cur_y < conf.n_rows)
             {
-                conf.cur_x = conf.row[conf.cur_y].size;                
+                conf.cur_x = editorRowAt(conf.cur_y)->size;
             }
             break;
 
@@ -492,6 +1380,11 @@ void texProcessKey(){
             break;
 
         case CTRL_KEY('l'):
+            texVScreenReset();
+            texSetStatusMessage("Frames: %lu drawn, %lu skipped",
+                                conf.frames_drawn, conf.frames_skipped);
+            break;
+
         case '\x1b':
             break;
 
@@ -504,6 +1397,11 @@ void texProcessKey(){
             break;
     }
     confirm_exit = FORCE_QUIT; // re-initialize
+    if (conf.cgap.row && (conf.cur_y >= conf.n_rows || editorRowAt(conf.cur_y) != conf.cgap.row))
+    {
+        editorGapClose(); // the cursor left the row
+    }
+    editorScroll(); // keys are batched between frames, viewport follows each one
 }
 
 /**
@@ -513,38 +1411,50 @@ void texProcessKey(){
  * @param key Input keystroke (arrow)
  */
 void texNavCursor(int key){
-    erow *row = (conf.cur_y >= conf.n_rows) ? NULL : &conf.row[conf.cur_y];
+    erow *row = (conf.cur_y >= conf.n_rows) ? NULL : editorRowAt(conf.cur_y);
 
     switch(key){
         case ARR_UP:
             if (conf.cur_y != 0)
             {
+                // same screen column, not the same byte; taken before the viewer
+                // slot cache can reuse row
+                int ren_x = row ? utilCur2Ren(row, conf.cur_x) : 0;
                 --conf.cur_y;
+                conf.cur_x = utilRen2Cur(editorRowAt(conf.cur_y), ren_x);
             }
             break;
 
         case ARR_DOWN:
             if (conf.cur_y < conf.n_rows)
             {
-                ++conf.cur_y;                
+                int ren_x = utilCur2Ren(row, conf.cur_x);
+                ++conf.cur_y;
+                if (conf.cur_y < conf.n_rows)
+                {
+                    conf.cur_x = utilRen2Cur(editorRowAt(conf.cur_y), ren_x);
+                }
             }
             break;
 
         case ARR_LEFT:
             if (conf.cur_x != 0)
             {
-                --conf.cur_x;
+                editorGapMove(row, conf.cur_x);
+                conf.cur_x = utilUtf8Prev(row->chars, conf.cur_x);
             }         
             else if (conf.cur_y > 0) {
                 --conf.cur_y;
-                conf.cur_x = conf.row[conf.cur_y].size;
+                conf.cur_x = editorRowAt(conf.cur_y)->size;
             }   
             break;
 
         case ARR_RIGHT:
             if (row && conf.cur_x < row -> size)
             {
-                conf.cur_x++;
+                int cp;
+                editorGapMove(row, conf.cur_x);
+                conf.cur_x += utilUtf8Decode(&row->chars[editorRowPos(row, conf.cur_x)], row->size - conf.cur_x, &cp);
             }
             else if (row && conf.cur_x == row->size) {
                 ++conf.cur_y;
@@ -554,7 +1464,7 @@ void texNavCursor(int key){
 
     }
 
-    row = (conf.cur_y >= conf.n_rows) ? NULL : &conf.row[conf.cur_y];
+    row = (conf.cur_y >= conf.n_rows) ? NULL : editorRowAt(conf.cur_y);
     int row_len = row ? row->size : 0;
     if (conf.cur_x > row_len)
     {
@@ -564,19 +1474,16 @@ void texNavCursor(int key){
 
 /**
  * @brief Output Handling
- * @details Refresh  Display
+ * @details Refresh  Display, only lines that differ from the last frame are sent
  * @args Escape <\x1b> + <[>: <esc> sequence
- * @args Erase-in-Display <2J>: clear all mode (2)
- * @args Cursor Position <1;1H>: Row 1 ; Col 1
+ * @args Cursor Position <Y;XH>: Row Y ; Col X
  */
 void texDispRefresh(){
+    static struct memBuf ab = BUF_INIT; // frame buffer, kept across frames
     editorScroll();
 
-    struct memBuf ab = BUF_INIT;
-
+    memBufReset(&ab);
     memBufAppend(&ab,"\x1b[?25l",6);
-    // FIXME: [1;1H format error bug for all previous versions
-    memBufAppend(&ab,"\x1b[H",3);
 
     texDrawLine(&ab);
     texDrawStatusBar(&ab);
@@ -590,7 +1497,31 @@ void texDispRefresh(){
     memBufAppend(&ab,"\x1b[?25h",6);
 
     write(STDIN_FILENO, ab.b, ab.len);
-    memBufFree(&ab);
+}
+
+/**
+ * @brief Output Handling
+ * @details Coalesce frames: draw only once queued input is drained
+ * @note Rate capped at FRAME_MIN_MS, forced after FRAME_MAX_MS of busy input
+ */
+void texDispFrame(){
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    long long since = utilClockMs() - conf.frame_time;
+
+    if (since < FRAME_MAX_MS)
+    {
+        int wait = since < FRAME_MIN_MS ? FRAME_MIN_MS - since : 0;
+
+        if (texInputPending() || poll(&pfd, 1, wait) > 0)
+        {
+            conf.frames_skipped++;
+            return;
+        }
+    }
+
+    texDispRefresh();
+    conf.frames_drawn++;
+    conf.frame_time = utilClockMs();
 }
 
 /**
@@ -598,10 +1529,13 @@ void texDispRefresh(){
  * @details Vimify with tildes at each line
  * @args nRows: Arbitrary no. of tildes
  */
-void texDrawLine(struct memBuf *ab){
+void texDrawLine(struct memBuf *ab_out){
+  static struct memBuf line = BUF_INIT;
+  struct memBuf *ab = &line;
   int i;
   for (i = 0; i < conf.dispRows; ++i) {
     int fp_row = i + conf.off_row;
+    memBufReset(ab);
 
     if (fp_row >= conf.n_rows)
     {
@@ -622,9 +1556,7 @@ void texDrawLine(struct memBuf *ab){
             memBufAppend(ab, "~", 1);
             --padding;
         }
-        while(--padding) {
-            memBufAppend(ab, " ", 1);
-        }
+        memBufRepeat(ab, ' ', padding - 1);
 
         memBufAppend(ab, wlcMsg, wlcLen);
 
@@ -633,22 +1565,112 @@ void texDrawLine(struct memBuf *ab){
         }
     }
     else {
-        int len = conf.row[fp_row].ren_sz - conf.off_col;
+        erow *row = editorRowAt(fp_row);
+        int limit = conf.off_col + conf.dispCols;
+
+        editorRowIndex(row);
+
+        // visible bytes [from, to), the first at column col; pad/tail: spaces for
+        // a tab or wide char cut by the left/right edge; s[j] is byte j from
+        // there on, past a gap
+        const char *s = row->chars;
+        int from, to, col, pad = 0, tail = 0, n, w;
+
+        if (editorRowPlain(row))
+        {
+            from = row->size < conf.off_col ? row->size : conf.off_col;
+            to = row->size < limit ? row->size : limit;
+            col = from;
+        }
+        else {
+            from = utilRen2Cur(row, conf.off_col);
+            col = utilCur2Ren(row, from);
+            s = editorRowTail(row, from);
+            if (col < conf.off_col && from < row->size)
+            {
+                from += utilCharNext(&s[from], row->size - from, col, &w);
+                pad = col + w - conf.off_col;
+                col += w;
+            }
 
-        if (len < 0)
+            int c = col;
+            to = from;
+            while (to < row->size) {
+                n = utilCharNext(&s[to], row->size - to, c, &w);
+                if (c + w > limit)
+                {
+                    tail = s[to] == '\t' ? limit - c : 0;
+                    break;
+                }
+                to += n;
+                c += w;
+            }
+        }
+
+        unsigned char *hl = NULL;
+        int base = 0;
+        if (conf.syntax)
         {
-            len = 0;
+            // colours from the row start, or the chunk start of a long row, to
+            // the visible end, from the cached state there
+            static unsigned char *hl_buf = NULL;
+            static int hl_cap = 0;
+            struct hlRun st;
+
+            editorHlSync(fp_row);
+            if (ROW_CHUNKS(row))
+            {
+                st = row->ext->chunks->c[editorChunkFind(row, from, &base, &n)].hl;
+                s = editorRowTail(row, base);
+            }
+            else {
+                editorHlBegin(&st, fp_row > 0 ? editorRowAt(fp_row - 1)->hl_state : HS_NONE);
+            }
+            if (to - base > hl_cap)
+            {
+                hl_cap = to - base + (to - base) / 2 + ROW_SLACK;
+                hl_buf = realloc(hl_buf, hl_cap);
+            }
+            editorHlRun(&st, s, row->size, base, to, hl_buf);
+            hl = hl_buf;
         }
 
-        if (len > conf.dispCols)
+        memBufRepeat(ab, ' ', pad);
+        if (hl == NULL && editorRowPlain(row))
         {
-            len = conf.dispCols;
+            memBufAppend(ab, &s[from], to - from);
+        }
+        else {
+            // colour escapes only where the colour changes
+            int color = HL_NORMAL;
+            int j;
+            for (j = from; j < to; j += n)
+            {
+                n = utilCharNext(&s[j], to - j, col, &w);
+                if (hl && hl[j - base] != color)
+                {
+                    char esc[16];
+                    color = hl[j - base];
+                    memBufAppend(ab, esc, snprintf(esc, sizeof(esc), "\x1b[%dm", editorHlColor(color)));
+                }
+                if (s[j] == '\t')
+                {
+                    memBufRepeat(ab, ' ', w);
+                }
+                else {
+                    memBufAppend(ab, &s[j], n);
+                }
+                col += w;
+            }
+            memBufRepeat(ab, ' ', tail);
+            if (color != HL_NORMAL)
+            {
+                memBufAppend(ab, "\x1b[39m", 5);
+            }
         }
-        memBufAppend(ab, &conf.row[fp_row].render[conf.off_col], len);
     }
 
-    memBufAppend(ab, "\x1b[K", 3);
-    memBufAppend(ab, "\r\n", 2);
+    texVScreenPut(ab_out, i, &line, 0);
   }
 }
 
@@ -658,37 +1680,46 @@ void texDrawLine(struct memBuf *ab){
  * 
  * @param memBuf memory buffer for Status Bar
  */
-void texDrawStatusBar(struct memBuf *ab) {
-    memBufAppend(ab, "\x1b[7m", 4);
-    char stt[80], cur_stt[80];
+void texDrawStatusBar(struct memBuf *ab_out) {
+    static struct memBuf line = BUF_INIT;
+    struct memBuf *ab = &line;
+    char stt[80], cur_stt[80], line_stt[24];
+    int len, cur_len;
 
-    int len = snprintf(stt, sizeof(stt), "%.20s - %d lines %s",
-    conf.file_name ? conf.file_name : "[No Name]", conf.n_rows,
-    conf.mod ? "(modified)" : "");
+    if (conf.view.floating)
+    {
+        // line numbers are unknown until the index catches up
+        len = snprintf(stt, sizeof(stt), "%.20s - ? lines (read-only)", conf.file_name);
+        snprintf(line_stt, sizeof(line_stt), "?/?");
+    }
+    else {
+        len = snprintf(stt, sizeof(stt), "%.20s - %d%s lines %s",
+        conf.file_name ? conf.file_name : "[No Name]", conf.n_rows,
+        (conf.viewer ? !conf.view.done : conf.load_at < conf.map_len) ? "+" : "",
+        conf.viewer ? "(read-only)" : conf.mod ? "(modified)" : "");
+        snprintf(line_stt, sizeof(line_stt), "%d/%d", conf.cur_y + 1, conf.n_rows);
+    }
 
-    int cur_len = snprintf(cur_stt, sizeof(cur_stt), "%d/%d", 
-       conf.cur_y + 1, conf.n_rows );
+    cur_len = snprintf(cur_stt, sizeof(cur_stt), "%s%s%s",
+       conf.syntax ? conf.syntax->name : "", conf.syntax ? " | " : "", line_stt);
 
     if (len > conf.dispCols)
     {
         len = conf.dispCols;
     }
 
+    memBufReset(ab);
     memBufAppend(ab, stt, len);
 
-    while (len < conf.dispCols) {
-        if (conf.dispCols - len == cur_len)
-        {
-            memBufAppend(ab, cur_stt, cur_len);
-            break;
-        }
-        else {
-            memBufAppend(ab, " ", 1);
-            ++len;
-        }
+    if (conf.dispCols - len >= cur_len)
+    {
+        memBufRepeat(ab, ' ', conf.dispCols - len - cur_len);
+        memBufAppend(ab, cur_stt, cur_len);
     }
-    memBufAppend(ab, "\x1b[m", 3);
-    memBufAppend(ab, "\r\n", 2);
+    else {
+        memBufRepeat(ab, ' ', conf.dispCols - len);
+    }
+    texVScreenPut(ab_out, conf.dispRows, &line, 1);
 }
 
 /**
@@ -697,8 +1728,10 @@ void texDrawStatusBar(struct memBuf *ab) {
  * 
  * @param memBuf memory buffer for Status Message
  */
-void texDrawStatusMsg(struct memBuf *ab) {
-    memBufAppend(ab, "\x1b[K", 3);
+void texDrawStatusMsg(struct memBuf *ab_out) {
+    static struct memBuf line = BUF_INIT;
+    struct memBuf *ab = &line;
+    memBufReset(ab);
     int msg_len = strlen(conf.stt_msg);
 
     if (msg_len > conf.dispCols)
@@ -710,6 +1743,101 @@ void texDrawStatusMsg(struct memBuf *ab) {
     {
         memBufAppend(ab, conf.stt_msg, msg_len);
     }
+    texVScreenPut(ab_out, conf.dispRows + 1, &line, 0);
+}
+
+/**
+ * @brief Virtual Screen
+ * @details Diff a freshly drawn line against the last frame, emit the change
+ * @note Plain ASCII lines only resend the span between common prefix/suffix
+ * 
+ * @param ab Output buffer for the terminal
+ * @param y Terminal line (0-based)
+ * @param line New content, swapped with the stale copy so buffers are reused
+ * @param rev Reverse video
+ */
+void texVScreenPut(struct memBuf *ab, int y, struct memBuf *line, int rev) {
+    struct vLine *old = &conf.vscr[y];
+
+    if (old->ln.len == line->len && old->rev == rev &&
+        (line->len == 0 || memcmp(old->ln.b, line->b, line->len) == 0))
+    {
+        return;
+    }
+
+    int from = 0;
+    int to = line->len;
+    int plain = old->ln.len >= 0 && old->rev == rev;
+    int i;
+
+    for (i = 0; plain && i < old->ln.len; ++i)
+    {
+        plain = old->ln.b[i] >= ' ' && old->ln.b[i] < 127;
+    }
+    for (i = 0; plain && i < line->len; ++i)
+    {
+        plain = line->b[i] >= ' ' && line->b[i] < 127;
+    }
+
+    if (plain)
+    {
+        while (from < to && from < old->ln.len && old->ln.b[from] == line->b[from]) {
+            ++from;
+        }
+        if (old->ln.len == line->len)
+        {
+            while (to > from && old->ln.b[to - 1] == line->b[to - 1]) {
+                --to;
+            }
+        }
+    }
+
+    char pos[32];
+    int pos_len = snprintf(pos, sizeof(pos), "\x1b[%d;%dH", y + 1, from + 1);
+    memBufAppend(ab, pos, pos_len);
+
+    if (rev)
+    {
+        memBufAppend(ab, "\x1b[7m", 4);
+    }
+    memBufAppend(ab, &line->b[from], to - from);
+    if (rev)
+    {
+        memBufAppend(ab, "\x1b[m", 3);
+    }
+    if (to == line->len)
+    {
+        memBufAppend(ab, "\x1b[K", 3);
+    }
+
+    struct memBuf stale = old->ln;
+    old->ln = *line;
+    old->rev = rev;
+    *line = stale;
+}
+
+/**
+ * @brief Virtual Screen
+ * @details Forget the last frame, next refresh redraws every line
+ */
+void texVScreenReset() {
+    int i;
+
+    if (conf.vscr == NULL)
+    {
+        conf.vscr = malloc(sizeof(struct vLine) * (conf.dispRows + 2));
+        for (i = 0; i < conf.dispRows + 2; ++i)
+        {
+            conf.vscr[i].ln.b = NULL;
+            conf.vscr[i].ln.cap = 0;
+        }
+    }
+
+    for (i = 0; i < conf.dispRows + 2; ++i)
+    {
+        conf.vscr[i].ln.len = -1;
+        conf.vscr[i].rev = 0;
+    }
 }
 
 /**
@@ -717,9 +1845,10 @@ void texDrawStatusMsg(struct memBuf *ab) {
  * @details Prompt in STT bar
  * 
  * @param prompt content
+ * @param callback Invoked after every key with (buffer, key), may be NULL
  * @return buffer
  */
-char *texUserPrompt(char *prompt) {
+char *texUserPrompt(char *prompt, void (*callback)(char *, int )) {
     size_t buf_sz = 128;
     char *buffer = malloc(buf_sz);
 
@@ -736,12 +1865,17 @@ char *texUserPrompt(char *prompt) {
         {
             if (buf_len != 0)
             {
-                buffer[--buf_len] = '\0';
+                buf_len = utilUtf8Prev(buffer, buf_len);
+                buffer[buf_len] = '\0';
             }
         }
         else if (c == '\x1b')
         {
             texSetStatusMessage("");
+            if (callback)
+            {
+                callback(buffer, c);
+            }
             free(buffer);
             return NULL;
         }
@@ -749,10 +1883,14 @@ char *texUserPrompt(char *prompt) {
             if (buf_len != 0)
             {
                 texSetStatusMessage("");
+                if (callback)
+                {
+                    callback(buffer, c);
+                }
                 return buffer;
             }
         }
-        else if (!iscntrl(c) && c < 128) {
+        else if (c < 256 && (c >= 128 || !iscntrl(c))) {
             if (buf_len == buf_sz - 1)
             {
                 buf_sz *= 2;
@@ -762,6 +1900,11 @@ char *texUserPrompt(char *prompt) {
             buffer[buf_len++] = c;
             buffer[buf_len] = '\0';
         }
+
+        if (callback)
+        {
+            callback(buffer, c);
+        }
     }
 }
 
@@ -781,16 +1924,41 @@ void texSetStatusMessage(const char *fmt, ...) {
 
 /**
  * @brief High-level Editor handling
- * @details Allocate memory, dynamic string for input
+ * @details Map file read-only, rows borrow their chars from the mapping
+ * @note Nothing is read yet: rows are made as the view reaches them, see editorLoadTo
+ * @note Falls back to getline() for empty or non-mappable files
  */
 void editorOpen(char *file_name){
     free(conf.file_name);
     conf.file_name = strdup(file_name);
+    editorSelectSyntax();
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        texTerminate("open");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            close(fd);
+            conf.map = map;
+            conf.map_len = st.st_size;
+            conf.load_at = 0;
+            conf.mod = 0;
+            return;
+        }
+    }
 
-    FILE *fp = fopen(file_name, "r");
+    FILE *fp = fdopen(fd, "r");
     if (!fp)
     {
-        texTerminate("fopen");
+        texTerminate("fdopen");
     }
 
     char *line = NULL;
@@ -811,381 +1979,4933 @@ void editorOpen(char *file_name){
 
 /**
  * @brief File I/O Handling
- * @details Save any changes
+ * @details Save any changes, snapshot rows and write them in the background
+ * @note Editing continues meanwhile, shared rows are copied before any change
  */
 void editorSave() {
+    struct saveJob *job = &conf.save;
+
+    if (editorReadOnly())
+    {
+        return;
+    }
+
+    if (job->active)
+    {
+        texSetStatusMessage("Save in progress, please wait");
+        return;
+    }
+
     if (conf.file_name == NULL)
     {
-        conf.file_name = texUserPrompt("Save as: %s (<ESC> to cancel)");
+        conf.file_name = texUserPrompt("Save as: %s (<ESC> to cancel)", NULL);
 
         if (conf.file_name == NULL)
         {
             texSetStatusMessage("Save cancelled");
             return;
         }
+        editorSelectSyntax();
     }
 
-    int len;
-    char *buffer = utilRow2Str(&len);
+    // atomic save: temp file in the same directory, fsync, rename over the target
+    char *real = realpath(conf.file_name, NULL);
+    job->target = real ? real : strdup(conf.file_name);
 
-    int fp = open(conf.file_name, O_RDWR | O_CREAT, 0644);
+    char *slash = strrchr(job->target, '/');
+    char *dir = slash ? strndup(job->target, slash == job->target ? 1 : slash - job->target)
+                      : strdup(".");
+    job->atomic = access(dir, W_OK) == 0;
+    free(dir);
 
-    if (fp != -1)
+    struct stat st;
+    if (stat(job->target, &st) == 0)
     {
-        if (ftruncate(fp, len) != -1)
-        {
-            if (write(fp, buffer, len) == len)
-            {
-                close(fp);
-                free(buffer);
-                conf.mod = 0;
-                texSetStatusMessage("%d bytes written to file", len);
-                return;
-            }
-        }
-        close(fp);
+        job->mode = st.st_mode & 07777;
+    }
+    else {
+        mode_t mask = umask(0);
+        umask(mask);
+        job->mode = 0644 & ~mask;
     }
-    free(buffer);
-    texSetStatusMessage("Cannot save ! I/O Error: %s", strerror(errno));
-}
 
-/**
- * @brief High-level Editor handling
- * @details Read each line from file input
- * 
- * @param s Line from file
- * @param len Line Length
- */
-void editorAppendChar(int at, char *s, size_t len){
-    if (at < 0 || at > conf.n_rows)
+    editorLoadAll();
+    if (!job->atomic)
     {
-        return;
+        // truncating the mapped file in place would pull pages from under the rows
+        editorDetachMap();
     }
 
-    conf.row = realloc(conf.row, sizeof(erow) * (conf.n_rows + 1) );
-    memmove(&conf.row[at + 1], &conf.row[at], sizeof(erow) * (conf.n_rows - at) );
+    job->rows = malloc(sizeof(struct iovec) * (conf.n_rows ? conf.n_rows : 1));
+    job->n_rows = conf.n_rows;
+    job->total = 0;
+    job->gen++;
 
-    conf.row[at].size = len;
-    conf.row[at].chars = malloc (len + 1);
-    memcpy(conf.row[at].chars, s, len);
-    conf.row[at].chars[len] = '\0';
-    
-    conf.row[at].ren_sz = 0;
-    conf.row[at].render = NULL;
-    editorUpdateRow(&conf.row[at]);
+    int i;
+    for (i = 0; i < conf.n_rows; ++i)
+    {
+        erow *row = editorRowAt(i);
+        if (row->cap)
+        {
+            editorRowExt(row)->snap = job->gen; // borrowed chars are never freed under it
+        }
+        job->rows[i].iov_base = row->chars;
+        job->rows[i].iov_len = row->size;
+        job->total += row->size + 1;
+    }
 
-    conf.n_rows++;
-    conf.mod++;
-}
+    job->file_name = strdup(conf.file_name);
+    job->mod = conf.mod;
+    job->done = 0;
+    job->err = 0;
+    job->finished = 0;
+    job->n_garbage = 0;
+    job->active = 1;
 
-/**
- * @brief High-level Editor Handling
- * @details Append entire row of char, i.e. String
- * 
- * @param erow Current Row Struct
- * @param s Append String Pointer
- * @param len String Length
- */
-void editorAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    conf.mod++;
+    if (pthread_create(&job->tid, NULL, editorSaveWorker, job) != 0)
+    {
+        editorSaveWorker(job);
+        job->tid = pthread_self();
+    }
+    editorSavePoll();
 }
 
 /**
- * @brief High-level Editor Handling
- * @details Insert a new line or break into 2 lines
+ * @brief File I/O Handling
+ * @details Writer thread: write the snapshot to a temp file, fsync, rename
+ * @note In-place rewrite only when the directory is not writable
+ * @note Touches only the snapshot and the locked fields of the job
+ * 
+ * @param arg struct saveJob
  */
-void editorInsertNewLine() {
-    if (conf.cur_x == 0)
+void *editorSaveWorker(void *arg) {
+    struct saveJob *job = arg;
+    int err = 0;
+    int fd;
+    long long t0;
+    char *tmp = NULL;
+    char *slash = strrchr(job->target, '/');
+    int dir_len = slash ? slash - job->target + 1 : 0;
+
+    job->sync_ms = 0;
+
+    if (job->atomic)
     {
-        editorAppendChar(conf.cur_y, "", 0);
+        tmp = malloc(strlen(job->target) + 16);
+        if (tmp == NULL)
+        {
+            fd = -1;
+            errno = ENOMEM; // fails the job below, like an open error
+        }
+        else {
+            sprintf(tmp, "%.*s.%s.XXXXXX", dir_len, job->target, job->target + dir_len);
+            fd = mkstemp(tmp);
+            if (fd != -1)
+            {
+                fchmod(fd, job->mode);
+            }
+        }
     }
     else {
-        erow *row = &conf.row[conf.cur_y];
-        editorAppendChar(conf.cur_y + 1, &row->chars[conf.cur_x], row->size - conf.cur_x);
-        row = &conf.row[conf.cur_y];
-        row->size = conf.cur_x;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        fd = open(job->target, O_WRONLY | O_CREAT | O_TRUNC, job->mode);
     }
-    conf.cur_y++;
-    conf.cur_x = 0;
-}
-
-/**
- * @brief High-level Editor handling
- * @details Scrolling feature
- */
-void editorScroll(){
-    conf.ren_x = 0;
 
-    if (conf.cur_y < conf.n_rows)
+    if (fd == -1)
     {
-        conf.ren_x = utilCur2Ren(&conf.row[conf.cur_y], conf.cur_x);
+        err = errno;
     }
+    else {
+        err = editorSaveStream(job, fd);
 
+        t0 = utilClockMs();
+        if (!err && fsync(fd) == -1)
+        {
+            err = errno;
+        }
+        job->sync_ms += utilClockMs() - t0;
 
-    if (conf.cur_y < conf.off_row)
-    {
-        conf.off_row = conf.cur_y;
+        if (close(fd) == -1 && !err)
+        {
+            err = errno;
+        }
     }
 
-    if (conf.cur_y >= conf.off_row + conf.dispRows)
+    if (tmp)
     {
-        conf.off_row = conf.cur_y - conf.dispRows + 1;
-    }
+        if (!err && rename(tmp, job->target) == -1)
+        {
+            err = errno;
+        }
 
-    if (conf.ren_x < conf.off_col)
+        if (err)
+        {
+            unlink(tmp);
+        }
+        else {
+            // make the rename itself durable
+            memcpy(tmp, job->target, dir_len);
+            strcpy(tmp + dir_len, ".");
+
+            int dir_fd = open(tmp, O_RDONLY);
+            if (dir_fd != -1)
+            {
+                t0 = utilClockMs();
+                fsync(dir_fd);
+                job->sync_ms += utilClockMs() - t0;
+                close(dir_fd);
+            }
+        }
+        free(tmp);
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->err = err;
+    job->finished = 1;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/**
+ * @brief File I/O Handling
+ * @details Stream the snapshot with writev()
+ * @note Zero-copy, iovecs point at the row chars and one shared newline
+ * 
+ * @param job Save job
+ * @param fd Destination
+ * @return errno or 0
+ */
+int editorSaveStream(struct saveJob *job, int fd) {
+    static char newline[] = "\n";
+    struct iovec iov[SAVE_IOV];
+    int cnt = 0;
+    long long len = 0;
+    int err = 0;
+    int i;
+
+    for (i = 0; i < job->n_rows && !err; ++i)
+    {
+        iov[cnt++] = job->rows[i];
+        iov[cnt].iov_base = newline;
+        iov[cnt++].iov_len = 1;
+        len += job->rows[i].iov_len + 1;
+
+        if (cnt + 2 <= SAVE_IOV && i + 1 < job->n_rows)
+        {
+            continue;
+        }
+
+        if (utilWritevAll(fd, iov, cnt) == -1)
+        {
+            err = errno;
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->done += len;
+        pthread_mutex_unlock(&job->lock);
+        cnt = 0;
+        len = 0;
+    }
+    return err;
+}
+
+/**
+ * @brief File I/O Handling
+ * @details Report save progress, reap the writer once it is done
+ */
+void editorSavePoll() {
+    struct saveJob *job = &conf.save;
+
+    if (!job->active)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    int finished = job->finished;
+    int err = job->err;
+    long long done = job->done;
+    pthread_mutex_unlock(&job->lock);
+
+    if (!finished)
+    {
+        texSetStatusMessage("Saving %.20s... %lld%%", job->file_name,
+                            job->total ? done * 100 / job->total : 100);
+        return;
+    }
+
+    if (!pthread_equal(job->tid, pthread_self()))
+    {
+        pthread_join(job->tid, NULL);
+    }
+
+    int i;
+    for (i = 0; i < job->n_garbage; ++i)
+    {
+        free(job->garbage[i]);
+    }
+    job->n_garbage = 0;
+    free(job->rows);
+    job->rows = NULL;
+    job->active = 0;
+
+    if (err)
+    {
+        texSetStatusMessage("Cannot save ! I/O Error: %s", strerror(err));
+    }
+    else {
+        if (conf.mod == job->mod)
+        {
+            conf.mod = 0;
+        }
+        texSetStatusMessage("%lld bytes written to file%s (fsync %lld ms)", job->total,
+                            job->atomic ? "" : " in place", job->sync_ms);
+    }
+    free(job->file_name);
+    free(job->target);
+    job->file_name = NULL;
+    job->target = NULL;
+}
+
+/**
+ * @brief File I/O Handling
+ * @details Block until a background save has finished
+ */
+void editorSaveWait() {
+    if (conf.save.active)
+    {
+        pthread_join(conf.save.tid, NULL);
+        conf.save.tid = pthread_self();
+        editorSavePoll();
+    }
+}
+
+/**
+ * @brief File I/O Handling
+ * @details Defer freeing chars the writer may still be reading
+ * 
+ * @param chars Buffer dropped by the editor
+ */
+void editorSaveGarbage(char *chars) {
+    struct saveJob *job = &conf.save;
+
+    if (job->n_garbage == job->garbage_cap)
+    {
+        job->garbage_cap = job->garbage_cap ? job->garbage_cap * 2 : ROW_GAP_MIN;
+        job->garbage = realloc(job->garbage, sizeof(char *) * job->garbage_cap);
+    }
+    job->garbage[job->n_garbage++] = chars;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Read each line from file input
+ * 
+ * @param s Line from file
+ * @param len Line Length
+ */
+void editorAppendChar(int at, char *s, size_t len){
+    if (at < 0 || at > conf.n_rows)
+    {
+        return;
+    }
+
+    erow *row = editorRowSlot(at);
+
+    row->size = len;
+    row->cap = len + 1;
+    row->chars = malloc (row->cap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    
+    row->ext = NULL;
+    editorUpdateRow(row);
+
+    conf.mod++;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Insert a row borrowing its chars from the file mapping
+ * @note No copy and no index, both are deferred until needed
+ * 
+ * @param s Line inside conf.map
+ * @param len Line Length
+ */
+void editorAppendMapped(int at, char *s, size_t len){
+    if (at < 0 || at > conf.n_rows)
+    {
+        return;
+    }
+
+    erow *row = editorRowSlot(at);
+
+    row->size = len;
+    row->chars = s;
+    row->cap = 0;
+    row->ext = NULL;
+    row->indexed = 0;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Add rows from the mapping until row at exists (or the file ends)
+ * @note Unread lines always follow every row there is, whatever was edited
+ * 
+ * @param at Row wanted
+ */
+void editorLoadTo(int at){
+    char *end = conf.map + conf.map_len;
+
+    if (conf.viewer)
+    {
+        return; // the viewer indexes the mapping itself
+    }
+
+    while (conf.n_rows <= at && conf.load_at < conf.map_len) {
+        char *p = conf.map + conf.load_at;
+        char *nl = memchr(p, '\n', end - p);
+        char *eol = nl ? nl : end;
+        size_t line_len = eol - p;
+
+        while (line_len > 0 && p[line_len - 1] == '\r')
+          line_len--;
+        editorAppendMapped(conf.n_rows, p, line_len);
+
+        conf.load_at = nl ? (size_t) (nl + 1 - conf.map) : conf.map_len;
+    }
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Bulk load the rest: count lines, size the row table once, then fill it
+ * @note For whatever needs every row: save, search, replace, the file end
+ */
+void editorLoadAll(){
+    char *p = conf.map + conf.load_at;
+    char *end = conf.map + conf.map_len;
+    int lines = 0;
+
+    if (conf.viewer || conf.load_at >= conf.map_len)
+    {
+        return;
+    }
+
+    while (p < end) {
+        char *nl = memchr(p, '\n', end - p);
+        ++lines;
+        if (nl == NULL)
+        {
+            break;
+        }
+        p = nl + 1;
+    }
+
+    editorRowReserve(lines);
+    editorLoadTo(INT_MAX);
+}
+
+/**
+ * @brief High-level Editor Handling
+ * @details Append entire row of char, i.e. String
+ * 
+ * @param erow Current Row Struct
+ * @param s Append String Pointer
+ * @param len String Length
+ */
+void editorAppendString(erow *row, char *s, size_t len) {
+    utilRowReserve(row, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    conf.mod++;
+}
+
+/**
+ * @brief High-level Editor Handling
+ * @details Insert a new line or break into 2 lines
+ */
+void editorInsertNewLine() {
+    if (editorReadOnly())
+    {
+        return;
+    }
+
+    if (conf.cur_y == conf.n_rows)
+    {
+        editorUndoRecord(UNDO_ROW_INS, conf.cur_y, 0, "", 0);
+    }
+    else {
+        editorUndoRecord(UNDO_INS, conf.cur_y, conf.cur_x, "\n", 1);
+    }
+
+    if (conf.cur_x == 0)
+    {
+        editorAppendChar(conf.cur_y, "", 0);
+    }
+    else {
+        erow *row = editorRowAt(conf.cur_y);
+        editorAppendChar(conf.cur_y + 1, &row->chars[conf.cur_x], row->size - conf.cur_x);
+        editorHlDirty(conf.cur_y);
+        row = editorRowAt(conf.cur_y);
+        editorRowOwn(row);
+        row->size = conf.cur_x;
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+    }
+    conf.cur_y++;
+    conf.cur_x = 0;
+}
+
+/**
+ * @brief High-level Editor Handling
+ * @details Insert a block of text at the cursor in one pass
+ * @note CR, LF and CRLF all break lines; each row is written once
+ * 
+ * @param s Text
+ * @param len Text Length
+ */
+void editorInsertText(char *s, int len) {
+    if (len <= 0 || editorReadOnly())
+    {
+        return;
+    }
+
+    if (conf.cur_y == conf.n_rows)
+    {
+        editorUndoRecord(UNDO_ROW_INS, conf.n_rows, 0, "", 0);
+        editorAppendChar(conf.n_rows, "", 0);
+    }
+
+    int breaks = 0;
+    int i, n = 0;
+    char *text = malloc(len);
+    for (i = 0; i < len; ++i)
+    {
+        if (s[i] == '\n' || (s[i] == '\r' && (i + 1 == len || s[i + 1] != '\n')))
+        {
+            ++breaks;
+        }
+        if (s[i] != '\r' || i + 1 == len || s[i + 1] != '\n')
+        {
+            text[n++] = s[i] == '\r' ? '\n' : s[i];
+        }
+    }
+    editorRowReserve(breaks);
+    editorUndoRecord(UNDO_INS, conf.cur_y, conf.cur_x, text, n); // breaks as "\n"
+    free(text);
+    editorHlDirty(conf.cur_y);
+
+    erow *row = editorRowAt(conf.cur_y);
+    editorRowOwn(row);
+
+    // text right of the cursor moves to the end of the last pasted line
+    int tail_len = row->size - conf.cur_x;
+    char *tail = malloc(tail_len + 1);
+    memcpy(tail, &row->chars[conf.cur_x], tail_len);
+    row->size = conf.cur_x;
+
+    char *p = s;
+    char *end = s + len;
+    while (1) {
+        char *eol = p;
+        while (eol < end && *eol != '\n' && *eol != '\r') {
+            ++eol;
+        }
+
+        int seg = eol - p;
+        utilRowReserve(row, row->size + seg + 1);
+        memcpy(&row->chars[row->size], p, seg);
+        row->size += seg;
+        conf.cur_x = row->size;
+
+        if (eol == end)
+        {
+            break;
+        }
+
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+
+        p = eol + 1;
+        if (*eol == '\r' && p < end && *p == '\n')
+        {
+            ++p;
+        }
+
+        conf.cur_y++;
+        editorAppendChar(conf.cur_y, "", 0);
+        row = editorRowAt(conf.cur_y);
+    }
+
+    utilRowReserve(row, row->size + tail_len + 1);
+    memcpy(&row->chars[row->size], tail, tail_len);
+    row->size += tail_len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    free(tail);
+
+    conf.mod++;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Scrolling feature
+ */
+void editorScroll(){
+    if (conf.viewer)
+    {
+        if (conf.view.floating)
+        {
+            // keep two pages of window above the view, to page and scroll up into
+            int low = conf.cur_y < conf.off_row ? conf.cur_y : conf.off_row;
+            if (low < 2 * conf.dispRows)
+            {
+                editorViewBack(3 * conf.dispRows - low);
+            }
+            editorViewSettle();
+        }
+        // index just far enough for the cursor plus a page either way
+        editorViewIndex(conf.cur_y + 2 * conf.dispRows);
+    }
+    else {
+        editorLoadTo(conf.cur_y + 2 * conf.dispRows); // rows as far as the view can go next
+    }
+
+    conf.ren_x = 0;
+
+    if (conf.cur_y < conf.n_rows)
+    {
+        conf.ren_x = utilCur2Ren(editorRowAt(conf.cur_y), conf.cur_x);
+    }
+
+
+    if (conf.cur_y < conf.off_row)
+    {
+        conf.off_row = conf.cur_y;
+    }
+
+    if (conf.cur_y >= conf.off_row + conf.dispRows)
+    {
+        conf.off_row = conf.cur_y - conf.dispRows + 1;
+    }
+
+    if (conf.ren_x < conf.off_col)
+    {
+        conf.off_col = conf.ren_x;
+    }
+
+    if (conf.ren_x >= conf.off_col + conf.dispCols)
+    {
+        conf.off_col = conf.ren_x - conf.dispCols + 1;
+    }
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Put the cursor on row y, same screen column, and row y on screen
+ *          line line
+ * @note One row lookup whatever the distance; y is clamped to [0, n_rows]
+ * @note The view never scrolls against the jump: a row already on screen
+ *       keeps the offset it has
+ * 
+ * @param y Row
+ * @param line Screen line wanted for it
+ */
+void editorJump(int y, int line) {
+    if (conf.viewer)
+    {
+        editorViewIndex(y);
+    }
+    else {
+        editorLoadTo(y);
+    }
+
+    if (y > conf.n_rows)
+    {
+        y = conf.n_rows;
+    }
+    if (y < 0)
+    {
+        y = 0;
+    }
+
+    int top = y > line ? y - line : 0;
+    if ((y >= conf.cur_y && top < conf.off_row) || (y < conf.cur_y && top > conf.off_row))
+    {
+        top = conf.off_row;
+    }
+
+    conf.cur_y = y;
+    conf.cur_x = y < conf.n_rows ? utilRen2Cur(editorRowAt(y), conf.ren_x) : 0;
+    conf.off_row = top;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Ctrl-G: jump to a line number, or to N% of the file
+ */
+void editorGoto() {
+    char *query = texUserPrompt("Go to: %s (line, or N%% of the file)", NULL);
+
+    if (query == NULL)
+    {
+        return;
+    }
+
+    char *end;
+    long n = strtol(query, &end, 10);
+    long long y;
+
+    if (end == query || (*end && strcmp(end, "%") != 0))
+    {
+        texSetStatusMessage("Not a line number: %.40s", query);
+    }
+    else if (*end == '%') {
+        n = n < 0 ? 0 : n > 100 ? 100 : n;
+        if (conf.viewer && !conf.view.done)
+        {
+            // N% of the bytes, on to the next line start
+            size_t off = (unsigned long long) conf.map_len * n / 100;
+            editorViewSeek(editorViewResync(off), conf.dispRows / 2);
+        }
+        else {
+            editorLoadAll();
+            y = (long long) conf.n_rows * n / 100;
+            editorJump(y < conf.n_rows ? y : conf.n_rows - 1, conf.dispRows / 2);
+        }
+    }
+    else {
+        // strtol saturates: clamp to the lines there are before n - 1
+        n = n < 1 ? 1 : n > INT_MAX ? INT_MAX : n;
+        if (conf.view.floating)
+        {
+            editorViewDrop(-1);
+        }
+        if (conf.viewer)
+        {
+            editorViewIndex((int) n - 1);
+        }
+        else {
+            editorLoadTo((int) n - 1);
+        }
+        if (n > conf.n_rows && conf.n_rows > 0)
+        {
+            n = conf.n_rows;
+        }
+        editorJump((int) n - 1, conf.dispRows / 2);
+    }
+    free(query);
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Row text changed: drop its index, rebuilt on next use
+ * 
+ * @param row File Input line
+ */
+void editorUpdateRow(erow *row) {
+    if (row == conf.cgap.row)
+    {
+        editorGapClose();
+    }
+    row->indexed = 0;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Index the chars of a row that are not plain bytes: tabs and
+ *          UTF-8 sequences
+ * @note Pure ASCII rows only look for tabs, with memchr; a plain row has no marks
+ * @note Rows over ROW_CHUNK bytes get chunk summaries instead, see editorChunkBuild
+ * 
+ * @param row File Input line
+ */
+void editorRowIndex(erow *row) {
+    const char *p = row->chars, *end = row->chars + row->size, *tab;
+    int col = 0;
+
+    if (row->indexed)
+    {
+        return;
+    }
+
+    row->indexed = 1;
+    if (row->ext)
+    {
+        row->ext->n_mark = 0;
+    }
+
+    if (row->size > ROW_CHUNK)
+    {
+        editorChunkBuild(row);
+        return;
+    }
+    if (row->ext)
+    {
+        free(row->ext->chunks);
+        row->ext->chunks = NULL;
+    }
+
+    if (utilIsAscii(row->chars, row->size))
+    {
+        while ((tab = memchr(p, '\t', end - p)) != NULL) {
+            col += tab - p;
+            col += TABS_TO_SPACES - (col % TABS_TO_SPACES);
+            p = tab + 1;
+            editorRowMark(row, p - row->chars, col);
+        }
+        return;
+    }
+
+    int i = 0;
+    while (i < row->size) {
+        int w;
+        int n = utilCharNext(&row->chars[i], row->size - i, col, &w);
+        i += n;
+        col += w;
+        if (n != 1 || w != 1 || row->chars[i - 1] == '\t')
+        {
+            editorRowMark(row, i, col);
+        }
+    }
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Bytes [at, at + delta) were inserted, or -delta bytes at at removed
+ * @note A long row redoes the summary of the one chunk holding at; any other
+ *       row drops its index
+ * 
+ * @param row File Input line
+ * @param at Byte offset
+ * @param delta Bytes added (> 0) or removed (< 0)
+ */
+void editorRowPatch(erow *row, int at, int delta) {
+    struct rowChunks *ck = ROW_CHUNKS(row);
+
+    if (ck == NULL || !row->indexed)
+    {
+        editorUpdateRow(row);
+        return;
+    }
+
+    int start, col;
+    int k = editorChunkFind(row, at, &start, &col);
+
+    ck->c[k].len += delta;
+    if (ck->c[k].len > 2 * ROW_CHUNK)
+    {
+        // grown too long, split in two
+        int len = ck->c[k].len / 2;
+        while (len > 1 && ((unsigned char) row->chars[editorRowPos(row, start + len)] & 0xc0) == 0x80) {
+            --len;
+        }
+        editorChunkReserve(row, ck->n + 1);
+        ck = row->ext->chunks;
+        memmove(&ck->c[k + 2], &ck->c[k + 1], sizeof(struct rowChunk) * (ck->n - k - 1));
+        ck->n++;
+        ck->c[k + 1].len = ck->c[k].len - len;
+        ck->c[k].len = len;
+        editorChunkSum(row, k + 1, start + len);
+        ck->hl_to = ck->hl_to > k + 1 ? ck->hl_to : k + 1;
+    }
+    editorChunkSum(row, k, start);
+
+    ck->hl_from = ck->hl_from < k ? ck->hl_from : k;
+    ck->hl_to = ck->hl_to > k ? ck->hl_to : k;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Cut a long row into chunks of at most ROW_CHUNK bytes
+ * @note A UTF-8 sequence never straddles two chunks
+ * 
+ * @param row File Input line
+ */
+void editorChunkBuild(erow *row) {
+    int start = 0, k = 0;
+
+    editorChunkReserve(row, row->size / ROW_CHUNK + 1);
+    while (start < row->size) {
+        int len = row->size - start;
+        if (len > ROW_CHUNK)
+        {
+            len = ROW_CHUNK;
+            while (len > 1 && ((unsigned char) row->chars[start + len] & 0xc0) == 0x80) {
+                --len;
+            }
+        }
+
+        editorChunkReserve(row, k + 1);
+        row->ext->chunks->c[k].len = len;
+        editorChunkSum(row, k, start);
+        start += len;
+        ++k;
+    }
+
+    row->ext->chunks->n = k;
+    row->ext->chunks->hl_from = 0;
+    row->ext->chunks->hl_to = k - 1;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Room for n chunks
+ * 
+ * @param row File Input line
+ * @param n Chunks needed
+ */
+void editorChunkReserve(erow *row, int n) {
+    struct rowExt *ext = editorRowExt(row);
+    int had = ext->chunks ? ext->chunks->cap : 0;
+
+    if (n <= had)
+    {
+        return;
+    }
+
+    int cap = n + n / 2 + 4;
+    ext->chunks = realloc(ext->chunks, sizeof(struct rowChunks) + sizeof(struct rowChunk) * cap);
+    ext->chunks->cap = cap;
+    if (had == 0)
+    {
+        ext->chunks->n = 0;
+    }
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Redo the column summary of one chunk
+ * 
+ * @param row File Input line
+ * @param k Chunk
+ * @param start Its first byte
+ */
+void editorChunkSum(erow *row, int k, int start) {
+    struct rowChunk *c = &row->ext->chunks->c[k];
+    const char *s[2], *tab;
+    int n[2], i, col = 0;
+    int m = editorRowSpans(row, start, start + c->len, s, n);
+
+    c->tab = 0;
+    for (i = 0; i < m; ++i)
+    {
+        tab = c->tab ? NULL : memchr(s[i], '\t', n[i]);
+        if (tab)
+        {
+            c->pre = utilColAdvance(s[i], tab - s[i], col);
+            c->tab = 1;
+            col = utilColAdvance(tab + 1, n[i] - (tab - s[i]) - 1, 0);
+        }
+        else {
+            col = utilColAdvance(s[i], n[i], col);
+        }
+    }
+
+    if (c->tab)
+    {
+        c->rest = col;
+    }
+    else {
+        c->pre = col;
+        c->rest = 0;
+    }
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Column a chunk ends at
+ * 
+ * @param c Chunk
+ * @param col Column it starts at
+ * @return Column
+ */
+int editorChunkCol(struct rowChunk *c, int col) {
+    if (c->tab)
+    {
+        return ((col + c->pre) / TABS_TO_SPACES + 1) * TABS_TO_SPACES + c->rest;
+    }
+    return col + c->pre;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Chunk holding byte at (the last one for at == size)
+ * 
+ * @param row File Input line, chunked
+ * @param at Byte offset
+ * @param start Its first byte
+ * @param col Its first column
+ * @return Chunk
+ */
+int editorChunkFind(erow *row, int at, int *start, int *col) {
+    struct rowChunks *ck = row->ext->chunks;
+    int k = 0;
+
+    *start = 0;
+    *col = 0;
+    while (k + 1 < ck->n && *start + ck->c[k].len <= at) {
+        *col = editorChunkCol(&ck->c[k], *col);
+        *start += ck->c[k].len;
+        ++k;
+    }
+    return k;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Append one mark to the row index
+ * 
+ * @param row Row
+ * @param at Byte just past the char
+ * @param col Column just past the char
+ */
+void editorRowMark(erow *row, int at, int col) {
+    struct rowExt *ext = editorRowExt(row);
+
+    if (ext->n_mark == ext->mark_cap)
+    {
+        ext->mark_cap = ext->mark_cap ? ext->mark_cap * 2 : 8;
+        ext->mark = realloc(ext->mark, sizeof(struct rowMark) * ext->mark_cap);
+    }
+    ext->mark[ext->n_mark].at = at;
+    ext->mark[ext->n_mark].col = col;
+    ext->n_mark++;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Side state of a row, made on first use
+ * 
+ * @param row Row
+ * @return Its ext
+ */
+struct rowExt *editorRowExt(erow *row) {
+    if (row->ext == NULL)
+    {
+        row->ext = calloc(1, sizeof(struct rowExt));
+    }
+    return row->ext;
+}
+
+/**
+ * @brief High-level Editor handling
+ * @details Indexed row of plain bytes only: no marks, no chunks
+ * 
+ * @param row Row, indexed
+ * @return plain/not: 1/0
+ */
+int editorRowPlain(erow *row) {
+    return row->ext == NULL || (row->ext->n_mark == 0 && row->ext->chunks == NULL);
+}
+
+/**
+ * @brief User Input Handling
+ * @details Invoke util to insert Char to row
+ * 
+ * @param c Input Character
+ */
+void editorInputChar(int c) {
+    if (editorReadOnly())
+    {
+        return;
+    }
+
+    if (conf.cur_y == conf.n_rows)
+    {
+        editorUndoRecord(UNDO_ROW_INS, conf.n_rows, 0, "", 0);
+        editorAppendChar(conf.n_rows,"", 0);
+    }
+
+    char ch = c;
+    editorUndoRecord(UNDO_INS, conf.cur_y, conf.cur_x, &ch, 1);
+    editorHlDirty(conf.cur_y);
+    utilCharInsert(editorRowAt(conf.cur_y), conf.cur_x, c);
+    ++conf.cur_x;
+}
+
+/**
+ * @brief User Input Handling
+ * @details Invoke util to delete Char from row
+ */
+void editorRemoveChar() {
+    if (editorReadOnly())
+    {
+        return;
+    }
+
+    if (conf.cur_y == conf.n_rows)
+    {
+        return;
+    }
+
+    if (conf.cur_x == 0 && conf.cur_y == 0)
+    {
+        return;
+    }
+
+    erow *row = editorRowAt(conf.cur_y);
+
+    if (conf.cur_x > 0)
+    {
+        editorGapMove(row, conf.cur_x); // the bytes before the cursor lie flat
+        int at = utilUtf8Prev(row->chars, conf.cur_x);
+        editorUndoRecord(UNDO_DEL, conf.cur_y, at, &row->chars[at], conf.cur_x - at);
+        editorHlDirty(conf.cur_y);
+        utilCharDel(row, at, conf.cur_x - at);
+        conf.cur_x = at;
+    }
+    else {
+        editorGapClose();
+        erow *prev = editorRowAt(conf.cur_y - 1);
+        editorUndoRecord(UNDO_DEL, conf.cur_y - 1, prev->size, "\n", 1);
+        editorHlDirty(conf.cur_y - 1);
+        conf.cur_x = prev->size;
+        editorAppendString(prev, row->chars, row->size);
+        editorRemoveRow(conf.cur_y);
+        --conf.cur_y;
+    }
+}
+
+/**
+ * @brief User Input Handling
+ * @details Invoke util to delete entire Row
+ * 
+ * @param at Current Row
+ */
+void editorRemoveRow(int at) {
+    if (at < 0 || at >= conf.n_rows)
+    {
+        return;
+    }
+
+    editorGapClose();
+    memFreeRow(editorRowAt(at));
+    editorRowGapMove(at + 1);
+    conf.gap_at = at;
+    --conf.n_rows;
+    editorHlShift(at, -1);
+    conf.mod++;
+}
+
+/**
+ * @brief User Input Handling
+ * @details Refuse edits in the read-only viewer
+ * @return read-only: 1/0
+ */
+int editorReadOnly() {
+    if (conf.viewer)
+    {
+        texSetStatusMessage("Read-only view (-R), file cannot be modified");
+    }
+    return conf.viewer;
+}
+
+/**
+ * @brief Row control
+ * @details Raw text of a row without rendering it (viewer rows included)
+ * 
+ * @param at Row index
+ * @param len Row Length
+ * @return Row chars, not NUL-terminated
+ */
+char *editorRowText(int at, int *len) {
+    if (conf.viewer)
+    {
+        return conf.map + editorViewLine(at, len);
+    }
+
+    erow *row = editorRowAt(at);
+    *len = row->size;
+    return row->chars;
+}
+
+/**
+ * @brief Search
+ * @details Incremental search: Ctrl-F, arrows step between matches, wraps
+ */
+void editorFind() {
+    struct findState *f = &conf.find;
+
+    if (conf.viewer)
+    {
+        editorViewAll(); // before the cursor is saved: a floating view gets renumbered
+    }
+    editorLoadAll();
+
+    f->orig_y = conf.cur_y;
+    f->orig_x = conf.cur_x;
+    f->orig_off_row = conf.off_row;
+    f->orig_off_col = conf.off_col;
+    f->last_y = -1;
+    f->re_ok = 1;
+    snprintf(f->prompt, sizeof(f->prompt), "%s: %%s (Use ESC/Arrows/Enter, Ctrl-T regex)",
+             f->regex ? "Regex" : "Search");
+
+    char *query = texUserPrompt(f->prompt, editorFindCallback);
+
+    editorSearchCancel(); // rows may change again from here on
+
+    if (query)
+    {
+        free(query);
+    }
+    else {
+        conf.cur_y = f->orig_y;
+        conf.cur_x = f->orig_x;
+        conf.off_row = f->orig_off_row;
+        conf.off_col = f->orig_off_col;
+    }
+}
+
+/**
+ * @brief Search
+ * @details texUserPrompt callback, jumps to a match on every keystroke
+ * 
+ * @param query Current prompt buffer
+ * @param key Last key
+ */
+void editorFindCallback(char *query, int key) {
+    struct findState *f = &conf.find;
+    int dir = 1;
+    int from_y, from_x;
+    int changed = 0;
+
+    if (key == '\r' || key == '\x1b')
+    {
+        return;
+    }
+    else if (key == ARR_RIGHT || key == ARR_DOWN) {
+        dir = 1;
+    }
+    else if (key == ARR_LEFT || key == ARR_UP) {
+        dir = -1;
+    }
+    else {
+        if (key == CTRL_KEY('t'))
+        {
+            f->regex = !f->regex;
+        }
+        f->last_y = -1; // query changed, search again from where we started
+        changed = 1;
+    }
+
+    if (changed)
+    {
+        editorSearchCancel(); // workers read f->re
+        f->re_ok = !f->regex || query[0] == '\0' || regexCompile(&f->re, query) == 0;
+        snprintf(f->prompt, sizeof(f->prompt), "%s: %%s (Use ESC/Arrows/Enter, Ctrl-T regex)",
+                 !f->regex ? "Search" : f->re_ok ? "Regex" : "Regex (invalid)");
+    }
+
+    if (query[0] == '\0' || conf.n_rows == 0 || !f->re_ok)
+    {
+        return;
+    }
+
+    if (f->last_y == -1)
+    {
+        from_y = f->orig_y < conf.n_rows ? f->orig_y : 0;
+        from_x = f->orig_y < conf.n_rows ? f->orig_x : 0;
+    }
+    else {
+        from_y = f->last_y;
+        from_x = f->last_x + dir;
+    }
+
+    if (changed && !conf.viewer)
+    {
+        editorSearchStart(query, strlen(query), from_y, f->regex ? &f->re : NULL);
+    }
+
+    int y, x, found;
+    if (conf.search.q)
+    {
+        found = editorSearchLookup(from_y, from_x, dir, &y, &x);
+    }
+    else {
+        found = editorFindNext(query, strlen(query), from_y, from_x, dir, &y, &x);
+    }
+
+    if (found)
+    {
+        f->last_y = y;
+        f->last_x = x;
+        conf.cur_y = y;
+        conf.cur_x = x;
+        conf.off_row = conf.n_rows; // editorScroll brings the match to the top
+    }
+}
+
+/**
+ * @brief Search
+ * @details Nearest match at or after (dir 1) / at or before (dir -1) a position
+ * @note Wraps around the buffer; rows scanned with utilMemMem, or with
+ *       regexStarts in regex mode (q unused then)
+ * 
+ * @param q Query
+ * @param q_len Query Length
+ * @param from_y Start Row
+ * @param from_x Start Column (may be -1 or past the row end)
+ * @param dir Direction: 1/-1
+ * @param y Match Row
+ * @param x Match Column
+ * @return found/not found: 1/0
+ */
+int editorFindNext(const char *q, int q_len, int from_y, int from_x, int dir, int *y, int *x) {
+    static int *starts = NULL;
+    static int starts_cap = 0;
+    int i;
+
+    if (conf.find.regex)
+    {
+        q_len = 0; // a match may start anywhere up to the row end
+    }
+
+    // n_rows + 1 steps: the start row is visited again for the wrapped part
+    for (i = 0; i <= conf.n_rows; ++i)
+    {
+        int at = ((from_y + dir * i) % conf.n_rows + conf.n_rows) % conf.n_rows;
+        int len;
+        const char *s = editorRowText(at, &len);
+        const char *hit;
+        int lo = 0, hi = len - q_len; // candidate starts
+
+        if (i == 0)
+        {
+            if (dir > 0)
+            {
+                lo = from_x;
+            }
+            else {
+                hi = from_x < hi ? from_x : hi;
+            }
+        }
+        else if (i == conf.n_rows) {
+            if (dir > 0)
+            {
+                hi = from_x - 1 < hi ? from_x - 1 : hi;
+            }
+            else {
+                lo = from_x + 1;
+            }
+        }
+
+        if (lo < 0)
+        {
+            lo = 0;
+        }
+        if (lo > hi)
+        {
+            continue;
+        }
+
+        if (conf.find.regex)
+        {
+            int n = regexStarts(&conf.find.re, &conf.find.dfa, s, len, &starts, &starts_cap);
+            int k = dir > 0 ? 0 : n - 1;
+
+            while (k >= 0 && k < n && (starts[k] < lo || starts[k] > hi)) {
+                k += dir;
+            }
+            if (k >= 0 && k < n)
+            {
+                *y = at;
+                *x = starts[k];
+                return 1;
+            }
+        }
+        else if (dir > 0)
+        {
+            hit = utilMemMem(s + lo, hi - lo + q_len, q, q_len);
+            if (hit)
+            {
+                *y = at;
+                *x = hit - s;
+                return 1;
+            }
+        }
+        else {
+            int last = -1;
+            while ((hit = utilMemMem(s + lo, hi - lo + q_len, q, q_len)) != NULL) {
+                last = hit - s;
+                lo = last + 1;
+                if (lo > hi)
+                {
+                    break;
+                }
+            }
+            if (last >= 0)
+            {
+                *y = at;
+                *x = last;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Search
+ * @details Start the worker pool on first use, one thread per online CPU
+ * 
+ * @return Worker count, 0 when threads are unavailable
+ */
+int editorSearchPool() {
+    struct searchPool *sp = &conf.search;
+
+    if (sp->n_threads != 0)
+    {
+        return sp->n_threads > 0 ? sp->n_threads : 0;
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+    {
+        n = 1;
+    }
+    if (n > FIND_THREADS_MAX)
+    {
+        n = FIND_THREADS_MAX;
+    }
+
+    sp->n_threads = 0;
+    while (sp->n_threads < n) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, editorSearchWorker, sp) != 0)
+        {
+            break;
+        }
+        pthread_detach(tid);
+        sp->n_threads++;
+    }
+
+    if (sp->n_threads == 0)
+    {
+        sp->n_threads = -1;
+        return 0;
+    }
+    return sp->n_threads;
+}
+
+/**
+ * @brief Search
+ * @details Cancel any running search and scan the whole buffer for a new query
+ * @note Chunks are handed out from the one holding from_y, so the nearest
+ *       match is usually ready long before the scan ends.
+ *       Falls back to editorFindNext (conf.search.q stays NULL) without threads
+ * 
+ * @param q Query
+ * @param q_len Query Length
+ * @param from_y Row the search starts at
+ * @param re Compiled regex or NULL, kept until editorSearchCancel
+ */
+void editorSearchStart(const char *q, int q_len, int from_y, struct regex *re) {
+    struct searchPool *sp = &conf.search;
+    int i;
+
+    editorSearchCancel();
+
+    if (editorSearchPool() == 0)
+    {
+        return;
+    }
+
+    int n_chunks = (conf.n_rows + FIND_CHUNK - 1) / FIND_CHUNK;
+    if (n_chunks > sp->chunk_cap)
+    {
+        sp->chunk = realloc(sp->chunk, sizeof(struct findChunk) * n_chunks);
+        for (i = sp->chunk_cap; i < n_chunks; ++i)
+        {
+            sp->chunk[i].m = NULL;
+            sp->chunk[i].cap = 0;
+        }
+        sp->chunk_cap = n_chunks;
+    }
+    for (i = 0; i < n_chunks; ++i)
+    {
+        sp->chunk[i].n = 0;
+        sp->chunk[i].done = 0;
+    }
+
+    sp->q = malloc(q_len + 1);
+    memcpy(sp->q, q, q_len + 1);
+    sp->q_len = q_len;
+    sp->re = re;
+    sp->merged = 0;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->start = from_y / FIND_CHUNK;
+    sp->next = 0;
+    sp->n_done = 0;
+    sp->n_chunks = n_chunks;
+    pthread_cond_broadcast(&sp->work);
+    pthread_mutex_unlock(&sp->lock);
+}
+
+/**
+ * @brief Search
+ * @details Stop the workers and wait until none of them touches a row
+ */
+void editorSearchCancel() {
+    struct searchPool *sp = &conf.search;
+
+    if (sp->q == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&sp->lock);
+    __atomic_add_fetch(&sp->gen, 1, __ATOMIC_RELAXED);
+    sp->n_chunks = 0;
+    while (sp->busy) {
+        pthread_cond_wait(&sp->done, &sp->lock);
+    }
+    pthread_mutex_unlock(&sp->lock);
+
+    free(sp->q);
+    sp->q = NULL;
+}
+
+/**
+ * @brief Search
+ * @details Worker: take the next chunk, collect every match in it
+ * @note Rows are only read; the editor does not edit while a search runs
+ * 
+ * @param arg struct searchPool
+ * @return NULL
+ */
+void *editorSearchWorker(void *arg) {
+    struct searchPool *sp = arg;
+    struct regexDfa dfa;
+    int *starts = NULL;
+    int starts_cap = 0;
+
+    memset(&dfa, 0, sizeof(dfa));
+
+    pthread_mutex_lock(&sp->lock);
+    while (1) {
+        while (sp->next >= sp->n_chunks) {
+            pthread_cond_wait(&sp->work, &sp->lock);
+        }
+
+        unsigned int gen = sp->gen;
+        struct findChunk *c = &sp->chunk[(sp->start + sp->next++) % sp->n_chunks];
+        int first = (c - sp->chunk) * FIND_CHUNK;
+        int last = first + FIND_CHUNK < conf.n_rows ? first + FIND_CHUNK : conf.n_rows;
+        sp->busy++;
+        pthread_mutex_unlock(&sp->lock);
+
+        int at;
+        for (at = first; at < last; ++at)
+        {
+            if (__atomic_load_n(&sp->gen, __ATOMIC_RELAXED) != gen)
+            {
+                break;
+            }
+
+            int len;
+            const char *s = editorRowText(at, &len);
+            const char *p = s;
+            const char *hit;
+
+            if (sp->re)
+            {
+                int k, n = regexStarts(sp->re, &dfa, s, len, &starts, &starts_cap);
+                for (k = 0; k < n; ++k)
+                {
+                    editorSearchAdd(c, at, starts[k]);
+                }
+                continue;
+            }
+
+            while ((hit = utilMemMem(p, len - (p - s), sp->q, sp->q_len)) != NULL) {
+                editorSearchAdd(c, at, hit - s);
+                p = hit + 1; // overlapping matches, like stepping does
+            }
+        }
+
+        pthread_mutex_lock(&sp->lock);
+        sp->busy--;
+        if (sp->gen == gen)
+        {
+            c->done = 1;
+            sp->n_done++;
+        }
+        pthread_cond_broadcast(&sp->done);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Search
+ * @details Append a match to a chunk
+ * 
+ * @param c Chunk
+ * @param y Match Row
+ * @param x Match Column
+ */
+void editorSearchAdd(struct findChunk *c, int y, int x) {
+    if (c->n == c->cap)
+    {
+        c->cap = c->cap ? c->cap * 2 : 64;
+        c->m = realloc(c->m, sizeof(struct findMatch) * c->cap);
+    }
+    c->m[c->n].y = y;
+    c->m[c->n].x = x;
+    c->n++;
+}
+
+/**
+ * @brief Search
+ * @details Chunks are already in row order, concatenate them once all are done
+ */
+void editorSearchMerge() {
+    struct searchPool *sp = &conf.search;
+    int i, n = 0;
+
+    for (i = 0; i < sp->n_chunks; ++i)
+    {
+        n += sp->chunk[i].n;
+    }
+    if (n > sp->match_cap)
+    {
+        sp->match = realloc(sp->match, sizeof(struct findMatch) * n);
+        sp->match_cap = n;
+    }
+
+    sp->n_match = 0;
+    for (i = 0; i < sp->n_chunks; ++i)
+    {
+        memcpy(sp->match + sp->n_match, sp->chunk[i].m, sizeof(struct findMatch) * sp->chunk[i].n);
+        sp->n_match += sp->chunk[i].n;
+    }
+    sp->merged = 1;
+}
+
+/**
+ * @brief Search
+ * @details Nearest match in the running search, same contract as editorFindNext
+ * @note Waits only for the chunks it needs until the scan is complete,
+ *       then binary-searches the merged list
+ * 
+ * @param from_y Start Row
+ * @param from_x Start Column
+ * @param dir Direction: 1/-1
+ * @param y Match Row
+ * @param x Match Column
+ * @return found/not found: 1/0
+ */
+int editorSearchLookup(int from_y, int from_x, int dir, int *y, int *x) {
+    struct searchPool *sp = &conf.search;
+    struct findMatch *m;
+    int n, i;
+
+    pthread_mutex_lock(&sp->lock);
+    if (!sp->merged && sp->n_done == sp->n_chunks)
+    {
+        editorSearchMerge();
+    }
+    pthread_mutex_unlock(&sp->lock);
+
+    // one pass over the merged list, or chunk by chunk from from_y; the
+    // start chunk is visited twice, the second time for the wrapped part
+    int steps = sp->merged ? 1 : sp->n_chunks + 1;
+    int c0 = from_y / FIND_CHUNK;
+
+    for (i = 0; i < steps; ++i)
+    {
+        if (sp->merged)
+        {
+            m = sp->match;
+            n = sp->n_match;
+        }
+        else {
+            struct findChunk *c = &sp->chunk[((c0 + dir * i) % sp->n_chunks + sp->n_chunks) % sp->n_chunks];
+
+            pthread_mutex_lock(&sp->lock);
+            while (!c->done) {
+                pthread_cond_wait(&sp->done, &sp->lock);
+            }
+            pthread_mutex_unlock(&sp->lock);
+
+            m = c->m;
+            n = c->n;
+        }
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        // lo: first match at or after (from_y, from_x)
+        int lo = 0, hi = n;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (m[mid].y < from_y || (m[mid].y == from_y && m[mid].x < from_x))
+            {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+
+        int k = -1;
+        if (dir > 0)
+        {
+            if (lo < n)
+            {
+                k = lo;
+            }
+            else if (sp->merged || i == sp->n_chunks) {
+                k = 0;
+            }
+        }
+        else {
+            if (lo < n && m[lo].y == from_y && m[lo].x == from_x)
+            {
+                k = lo;
+            }
+            else if (lo > 0) {
+                k = lo - 1;
+            }
+            else if (sp->merged || i == sp->n_chunks) {
+                k = n - 1;
+            }
+        }
+
+        if (i > 0 && i < sp->n_chunks && !sp->merged)
+        {
+            k = dir > 0 ? 0 : n - 1; // whole chunk lies past the start
+        }
+
+        if (k >= 0)
+        {
+            *y = m[k].y;
+            *x = m[k].x;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Search
+ * @details Replace all: prompt for a string and its replacement
+ */
+void editorReplace() {
+    if (editorReadOnly())
+    {
+        return;
+    }
+
+    char *query = texUserPrompt("Replace: %s (<ESC> to cancel)", NULL);
+    if (query == NULL)
+    {
+        return;
+    }
+
+    char *with = texUserPrompt("Replace with: %s (<ESC> to cancel)", NULL);
+    if (with == NULL)
+    {
+        free(query);
+        return;
+    }
+
+    long long t0 = utilClockMs();
+    editorLoadAll();
+    int n = editorReplaceAll(query, strlen(query), with, strlen(with));
+
+    texSetStatusMessage("Replaced %d occurrence%s in %lld ms", n, n == 1 ? "" : "s", utilClockMs() - t0);
+    free(query);
+    free(with);
+}
+
+/**
+ * @brief Search
+ * @details Replace every (non-overlapping) occurrence of a string
+ * @note One pass per row: the new chars are built aside and copied in;
+ *       conf.mod moves once for the whole batch
+ * @note Undo logs the changed spans only, hits close together share one
+ * 
+ * @param q Query
+ * @param q_len Query Length
+ * @param r Replacement
+ * @param r_len Replacement Length
+ * @return Number of replacements
+ */
+int editorReplaceAll(const char *q, int q_len, const char *r, int r_len) {
+    static struct memBuf line = BUF_INIT;
+    int total = 0;
+    int at;
+
+    for (at = 0; at < conf.n_rows; ++at)
+    {
+        erow *row = editorRowAt(at);
+        const char *s = row->chars;
+        const char *end = s + row->size;
+        const char *hit = utilMemMem(s, row->size, q, q_len);
+
+        if (hit == NULL)
+        {
+            continue;
+        }
+
+        // span being logged: old chars from span, new chars from span_x
+        const char *span = hit;
+        int span_x = hit - s;
+
+        memBufReset(&line);
+        while (hit) {
+            memBufAppend(&line, s, hit - s);
+            memBufAppend(&line, r, r_len);
+            s = hit + q_len;
+            total++;
+            hit = utilMemMem(s, end - s, q, q_len);
+
+            if (hit == NULL || hit - s > UNDO_SPAN_GAP)
+            {
+                editorUndoRecord(UNDO_DEL, at, span_x, span, s - span);
+                editorUndoRecord(UNDO_INS, at, span_x, line.b + span_x, line.len - span_x);
+                span = hit;
+                span_x = line.len + (hit - s);
+            }
+        }
+        memBufAppend(&line, s, end - s);
+
+        editorHlDirty(at);
+        utilRowReserve(row, line.len + 1);
+        memcpy(row->chars, line.b, line.len);
+        row->size = line.len;
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+
+        if (at == conf.cur_y)
+        {
+            // lengths changed under the cursor: clamp, then back onto a char start
+            int x = conf.cur_x < row->size ? conf.cur_x : row->size;
+            while (x > 0 && x < row->size && ((unsigned char) row->chars[x] & 0xc0) == 0x80) {
+                x = utilUtf8Prev(row->chars, x);
+            }
+            conf.cur_x = x;
+        }
+    }
+
+    if (total)
+    {
+        conf.mod++;
+    }
+    return total;
+}
+
+/**
+ * @brief Undo
+ * @details Empty log, budget from TEX_UNDO_LIMIT (bytes, k/m/g suffix)
+ */
+void editorUndoInit() {
+    struct undoLog *u = &conf.undo;
+    char *env = getenv("TEX_UNDO_LIMIT");
+
+    memset(u, 0, sizeof(*u));
+    u->limit = UNDO_LIMIT;
+
+    if (env && *env)
+    {
+        char *end;
+        long long v = strtoll(env, &end, 10);
+        switch (tolower((unsigned char) *end)) {
+            case 'g':
+                v <<= 10;
+                // fall through
+            case 'm':
+                v <<= 10;
+                // fall through
+            case 'k':
+                v <<= 10;
+                break;
+        }
+        if (v >= 0)
+        {
+            u->limit = v;
+        }
+    }
+}
+
+/**
+ * @brief Undo
+ * @details Group edits per command; a run of typing (or of deleting) is one
+ * 
+ * @param c Key about to be processed
+ */
+void editorUndoBoundary(int c) {
+    struct undoLog *u = &conf.undo;
+    int kind = 0;
+
+    if (u->logged && u->n > u->first)
+    {
+        // where the previous command left the cursor, for redo
+        u->op[u->n - 1].after_y = conf.cur_y;
+        u->op[u->n - 1].after_x = conf.cur_x;
+    }
+    u->logged = 0;
+
+    if (c == BKSP_KEY || c == CTRL_KEY('h') || c == DEL_KEY)
+    {
+        kind = 2;
+    }
+    else if (c == '\t' || (c >= ' ' && c < ARR_UP)) {
+        kind = 1;
+    }
+
+    if (kind == 0 || kind != u->kind)
+    {
+        u->open = 0;
+    }
+    u->kind = kind;
+}
+
+/**
+ * @brief Undo
+ * @details Log an edit before it is made, merged into the previous entry when
+ *          typing / deleting continues where it left off
+ * @note Clears the redo part; the budget is enforced by editorUndoEvict
+ * 
+ * @param type enum undoType
+ * @param y Row
+ * @param x Column
+ * @param s Text inserted / deleted, rows separated by "\n"
+ * @param len Text Length
+ */
+void editorUndoRecord(int type, int y, int x, const char *s, int len) {
+    struct undoLog *u = &conf.undo;
+
+    if (u->replay)
+    {
+        return;
+    }
+    u->logged = 1;
+    if (!u->open)
+    {
+        u->group++;
+        u->open = 1;
+        u->overflow = 0;
+    }
+    if (u->overflow)
+    {
+        return; // this command did not fit, the history was dropped
+    }
+
+    while (u->n > u->pos) {
+        u->n--;
+        u->bytes -= sizeof(struct undoOp) + u->op[u->n].cap;
+        free(u->op[u->n].text);
+    }
+
+    struct undoOp *last = u->n > u->first ? &u->op[u->n - 1] : NULL;
+    if (last && last->group == u->group && last->type == type && type != UNDO_ROW_INS)
+    {
+        int ey, ex;
+        struct undoOp op = {type, 0, y, x, len, 0, (char *) s, -1, 0};
+
+        if (type == UNDO_INS)
+        {
+            editorUndoEnd(last, &ey, &ex);
+            if (ey == y && ex == x)
+            {
+                editorUndoText(last, s, len, 0); // typing on
+                return;
+            }
+        }
+        else if (last->y == y && last->x == x) {
+            editorUndoText(last, s, len, 0); // Delete key
+            return;
+        }
+        else {
+            editorUndoEnd(&op, &ey, &ex);
+            if (ey == last->y && ex == last->x)
+            {
+                // move the start first: adding text may evict, last is stale after
+                last->y = y;
+                last->x = x;
+                editorUndoText(last, s, len, 1); // Backspace
+                return;
+            }
+        }
+    }
+
+    if (u->n == u->cap)
+    {
+        u->cap = u->cap ? u->cap * 2 : 64;
+        u->op = realloc(u->op, sizeof(struct undoOp) * u->cap);
+    }
+
+    struct undoOp *op = &u->op[u->n++];
+    op->type = type;
+    op->group = u->group;
+    op->y = y;
+    op->x = x;
+    op->len = 0;
+    op->cap = 0;
+    op->text = NULL;
+    op->after_y = -1;
+    op->after_x = 0;
+    u->bytes += sizeof(struct undoOp);
+    editorUndoText(op, s, len, 0);
+    u->pos = u->n;
+
+    editorUndoEvict();
+}
+
+/**
+ * @brief Undo
+ * @details Position right after an entry's text
+ * 
+ * @param op Entry
+ * @param y End Row
+ * @param x End Column
+ */
+void editorUndoEnd(struct undoOp *op, int *y, int *x) {
+    const char *p = op->text;
+    const char *end = op->text + op->len;
+    const char *nl;
+
+    *y = op->y;
+    *x = op->x;
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+        (*y)++;
+        *x = 0;
+        p = nl + 1;
+    }
+    *x += end - p;
+}
+
+/**
+ * @brief Undo
+ * @details Add text to an entry
+ * 
+ * @param op Entry
+ * @param s Text
+ * @param len Text Length
+ * @param front prepend/append: 1/0
+ */
+void editorUndoText(struct undoOp *op, const char *s, int len, int front) {
+    if (op->len + len > op->cap)
+    {
+        int cap = op->len + len + (op->len + len) / 2;
+        conf.undo.bytes += cap - op->cap;
+        op->text = realloc(op->text, cap ? cap : 1);
+        op->cap = cap;
+    }
+
+    if (front)
+    {
+        memmove(op->text + len, op->text, op->len);
+        memcpy(op->text, s, len);
+    }
+    else {
+        memcpy(op->text + op->len, s, len);
+    }
+    op->len += len;
+
+    if (conf.undo.bytes > conf.undo.limit)
+    {
+        editorUndoEvict();
+    }
+}
+
+/**
+ * @brief Undo
+ * @details Drop the oldest groups until the log fits its budget
+ * @note A command too large on its own drops the whole history instead:
+ *       older entries would no longer line up with the text
+ */
+void editorUndoEvict() {
+    struct undoLog *u = &conf.undo;
+
+    while (u->bytes > u->limit && u->first < u->n) {
+        unsigned int g = u->op[u->first].group;
+
+        if (g == u->group)
+        {
+            editorUndoClear();
+            u->overflow = 1;
+            texSetStatusMessage("Edit exceeds TEX_UNDO_LIMIT, undo history dropped");
+            return;
+        }
+
+        while (u->first < u->n && u->op[u->first].group == g) {
+            u->bytes -= sizeof(struct undoOp) + u->op[u->first].cap;
+            free(u->op[u->first].text);
+            u->first++;
+        }
+    }
+
+    if (u->first > 64 && u->first > u->n / 2)
+    {
+        memmove(u->op, u->op + u->first, sizeof(struct undoOp) * (u->n - u->first));
+        u->n -= u->first;
+        u->pos -= u->first;
+        u->first = 0;
+    }
+}
+
+/**
+ * @brief Undo
+ * @details Forget all history
+ */
+void editorUndoClear() {
+    struct undoLog *u = &conf.undo;
+    int i;
+
+    for (i = u->first; i < u->n; ++i)
+    {
+        free(u->op[i].text);
+    }
+    u->first = u->pos = u->n = 0;
+    u->bytes = 0;
+}
+
+/**
+ * @brief Undo
+ * @details Ctrl-Z: revert the last group
+ */
+void editorUndo() {
+    struct undoLog *u = &conf.undo;
+
+    if (editorReadOnly())
+    {
+        return;
+    }
+    if (u->pos == u->first)
+    {
+        texSetStatusMessage("Nothing to undo");
+        return;
+    }
+
+    unsigned int g = u->op[u->pos - 1].group;
+    u->replay = 1;
+    while (u->pos > u->first && u->op[u->pos - 1].group == g) {
+        editorUndoApply(&u->op[--u->pos], 1);
+    }
+    u->replay = 0;
+}
+
+/**
+ * @brief Undo
+ * @details Ctrl-Y: make the last undone group again
+ */
+void editorRedo() {
+    struct undoLog *u = &conf.undo;
+
+    if (editorReadOnly())
+    {
+        return;
+    }
+    if (u->pos == u->n)
+    {
+        texSetStatusMessage("Nothing to redo");
+        return;
+    }
+
+    unsigned int g = u->op[u->pos].group;
+    u->replay = 1;
+    while (u->pos < u->n && u->op[u->pos].group == g) {
+        editorUndoApply(&u->op[u->pos++], 0);
+    }
+    u->replay = 0;
+
+    struct undoOp *last = &u->op[u->pos - 1];
+    if (last->after_y >= 0 && last->after_y <= conf.n_rows)
+    {
+        conf.cur_y = last->after_y;
+        conf.cur_x = last->after_y < conf.n_rows ? last->after_x : 0;
+    }
+}
+
+/**
+ * @brief Undo
+ * @details Make an entry's edit or its inverse, the cursor follows
+ * 
+ * @param op Entry
+ * @param inverse undo/redo: 1/0
+ */
+void editorUndoApply(struct undoOp *op, int inverse) {
+    int ins = (op->type == UNDO_DEL) == inverse;
+
+    if (op->type == UNDO_ROW_INS)
+    {
+        if (inverse)
+        {
+            editorRemoveRow(op->y);
+        }
+        else {
+            editorAppendChar(op->y, op->text, op->len);
+        }
+        conf.cur_y = op->y;
+        conf.cur_x = 0;
+    }
+    else if (ins) {
+        editorUndoInsert(op->y, op->x, op->text, op->len);
+    }
+    else {
+        editorUndoDelete(op->y, op->x, op->len);
+    }
+}
+
+/**
+ * @brief Undo
+ * @details Insert text at a position, "\n" breaks the row
+ * @note Cursor ends up after the text; a position off the text is clamped
+ * 
+ * @param y Row
+ * @param x Column
+ * @param s Text
+ * @param len Text Length
+ */
+void editorUndoInsert(int y, int x, const char *s, int len) {
+    if (y < 0 || y >= conf.n_rows)
+    {
+        return; // the log is out of step with the text
+    }
+
+    erow *row = editorRowAt(y);
+    const char *end = s + len;
+
+    x = x < 0 ? 0 : x > row->size ? row->size : x;
+
+    editorHlDirty(y);
+    editorRowOwn(row);
+
+    int tail_len = row->size - x;
+    char *tail = malloc(tail_len + 1);
+    memcpy(tail, &row->chars[x], tail_len);
+    row->size = x;
+
+    while (1) {
+        const char *nl = memchr(s, '\n', end - s);
+        const char *eol = nl ? nl : end;
+
+        utilRowReserve(row, row->size + (eol - s) + 1);
+        memcpy(&row->chars[row->size], s, eol - s);
+        row->size += eol - s;
+
+        if (nl == NULL)
+        {
+            break;
+        }
+
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+        editorAppendChar(++y, "", 0);
+        row = editorRowAt(y);
+        s = nl + 1;
+    }
+
+    conf.cur_y = y;
+    conf.cur_x = row->size;
+
+    utilRowReserve(row, row->size + tail_len + 1);
+    memcpy(&row->chars[row->size], tail, tail_len);
+    row->size += tail_len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    free(tail);
+    conf.mod++;
+}
+
+/**
+ * @brief Undo
+ * @details Delete len bytes from a position, a row end counts as one byte
+ * @note Cursor ends up at the position; a range off the text is clamped
+ * 
+ * @param y Row
+ * @param x Column
+ * @param len Bytes
+ */
+void editorUndoDelete(int y, int x, int len) {
+    if (y < 0 || y >= conf.n_rows)
+    {
+        return; // the log is out of step with the text
+    }
+
+    int size = editorRowAt(y)->size;
+    x = x < 0 ? 0 : x > size ? size : x;
+    int ey = y, ex = x;
+
+    while (len > 0) {
+        int avail = editorRowAt(ey)->size - ex;
+        if (len <= avail || ey + 1 >= conf.n_rows)
+        {
+            ex += len <= avail ? len : avail;
+            break;
+        }
+        len -= avail + 1;
+        ey++;
+        ex = 0;
+    }
+
+    erow *row = editorRowAt(y);
+    erow *last = editorRowAt(ey);
+    int tail_len = last->size - ex;
+
+    editorHlDirty(y);
+    if (ey == y)
+    {
+        editorRowOwn(row);
+        memmove(&row->chars[x], &row->chars[ex], tail_len);
+    }
+    else {
+        utilRowReserve(row, x + tail_len + 1);
+        memcpy(&row->chars[x], &last->chars[ex], tail_len);
+    }
+    row->size = x + tail_len;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+
+    while (ey-- > y) {
+        editorRemoveRow(y + 1);
+    }
+
+    conf.cur_y = y;
+    conf.cur_x = x;
+    conf.mod++;
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details Pick the syntax from the file name, forget the highlighting done
+ */
+void editorSelectSyntax() {
+    const char *base;
+    unsigned int i;
+    int j;
+
+    conf.syntax = NULL;
+    conf.hl_upto = conf.hl_known = conf.hl_dirty = 0;
+
+    if (conf.file_name == NULL || conf.viewer)
+    {
+        return; // viewer rows live in a small slot cache, no state to carry
+    }
+
+    base = strrchr(conf.file_name, '/');
+    base = base ? base + 1 : conf.file_name;
+    const char *ext = strrchr(base, '.');
+
+    for (i = 0; i < HLDB_ENTRIES && conf.syntax == NULL; ++i)
+    {
+        for (j = 0; HLDB[i].match[j]; ++j)
+        {
+            if (strcmp(base, HLDB[i].match[j]) == 0 || (ext && strcmp(ext, HLDB[i].match[j]) == 0))
+            {
+                conf.syntax = &HLDB[i];
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details State machine over one row
+ * 
+ * @param s Row chars
+ * @param len Length
+ * @param state State at the start of the row
+ * @param hl Colour per byte, may be NULL when only the end state is wanted
+ * @return State at the end of the row
+ */
+unsigned char editorHlScan(const char *s, int len, unsigned char state, unsigned char *hl) {
+    struct hlRun st;
+
+    editorHlBegin(&st, state);
+    editorHlRun(&st, s, len, 0, len, hl);
+    return editorHlEnd(&st, s, len);
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details Scanner state at the start of a row
+ * 
+ * @param st Scanner state
+ * @param state State carried in from the row above
+ */
+void editorHlBegin(struct hlRun *st, unsigned char state) {
+    memset(st, 0, sizeof(*st));
+    st->in_comment = state == HS_COMMENT;
+    st->in_str = state == HS_DQUOTE ? '"' : state == HS_SQUOTE ? '\'' : 0;
+    st->in_key = (conf.syntax->flags & SYN_KEYS) && state == HS_NONE;
+    st->lead = state == HS_NONE;
+    st->prev_sep = 1;
+    st->prev_hl = HL_NORMAL;
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details Run the state machine over the slice [from, to) of a row
+ * @note Lookahead still sees the whole row, so running slice after slice
+ *       gives exactly the colours and state of one run over the row
+ * 
+ * @param st Scanner state, at from on entry and at to on return
+ * @param s Row chars
+ * @param len Row Length
+ * @param from Slice start
+ * @param to Slice end
+ * @param hl Colour per byte of the slice (hl[0] is s[from]), may be NULL
+ */
+void editorHlRun(struct hlRun *st, const char *s, int len, int from, int to, unsigned char *hl) {
+    const struct editorSyntax *syn = conf.syntax;
+    const char *lc = syn->line_comment;
+    const char *bs = syn->block_start;
+    const char *be = syn->block_end;
+    int lc_len = lc ? strlen(lc) : 0;
+    int bs_len = bs ? strlen(bs) : 0;
+    int be_len = be ? strlen(be) : 0;
+    int in_comment = st->in_comment;
+    int in_str = st->in_str;
+    int in_key = st->in_key;
+    int in_pre = st->in_pre;
+    int prev_sep = st->prev_sep;
+    int prev_hl = st->prev_hl;
+    int i = from + st->over, k;
+
+    if (hl)
+    {
+        // the tail of a token the previous slice ended in
+        memset(hl, prev_hl, st->over < to - from ? st->over : to - from);
+    }
+    if (st->in_line)
+    {
+        if (hl)
+        {
+            memset(hl, HL_COMMENT, to - from);
+        }
+        return;
+    }
+
+    while (st->lead && i < to) {
+        if (s[i] != ' ' && s[i] != '\t')
+        {
+            st->lead = 0;
+            in_pre = (syn->flags & SYN_PREPROC) && s[i] == '#';
+            if (in_key && s[i] == '[')
+            {
+                in_key = 0;
+                in_pre = 1; // [section]
+            }
+            break;
+        }
+        if (hl)
+        {
+            hl[i - from] = HL_NORMAL;
+        }
+        ++i;
+    }
+
+    // a token running past to is only coloured up to to
+#define HL_SET(n, t) do { if (hl) { memset(&hl[i - from], (t), (n) < to - i ? (n) : to - i); } prev_hl = (t); } while (0)
+
+    while (i < to) {
+        unsigned char c = s[i];
+
+        if (in_comment)
+        {
+            if (be_len && i + be_len <= len && memcmp(&s[i], be, be_len) == 0)
+            {
+                HL_SET(be_len, HL_COMMENT);
+                i += be_len;
+                in_comment = 0;
+                prev_sep = 1;
+                continue;
+            }
+            HL_SET(1, HL_COMMENT);
+            ++i;
+            continue;
+        }
+
+        if (in_str)
+        {
+            HL_SET(1, HL_STRING);
+            if (c == '\\' && i + 1 < len)
+            {
+                ++i;
+                HL_SET(1, HL_STRING);
+            }
+            else if (c == in_str) {
+                in_str = 0;
+            }
+            ++i;
+            prev_sep = 1;
+            continue;
+        }
+
+        if (lc_len && (prev_sep || lc_len > 1) && i + lc_len <= len && memcmp(&s[i], lc, lc_len) == 0)
+        {
+            HL_SET(len - i, HL_COMMENT);
+            st->in_line = 1;
+            break;
+        }
+
+        if (bs_len && i + bs_len <= len && memcmp(&s[i], bs, bs_len) == 0)
+        {
+            HL_SET(bs_len, HL_COMMENT);
+            i += bs_len;
+            in_comment = 1;
+            continue;
+        }
+
+        if ((syn->flags & SYN_STRINGS) && (c == '"' || c == '\''))
+        {
+            HL_SET(1, HL_STRING);
+            in_str = c;
+            ++i;
+            continue;
+        }
+
+        if ((syn->flags & SYN_VARS) && c == '$' && i + 1 < len)
+        {
+            int end = i + 1;
+            if (s[end] == '{')
+            {
+                while (end < len && s[end] != '}') {
+                    ++end;
+                }
+                end += end < len;
+            }
+            else if (isalnum((unsigned char) s[end]) || s[end] == '_') {
+                while (end < len && (isalnum((unsigned char) s[end]) || s[end] == '_')) {
+                    ++end;
+                }
+            }
+            else {
+                ++end; // $?, $#, $1 ...
+            }
+            HL_SET(end - i, HL_SPECIAL);
+            i = end;
+            prev_sep = 0;
+            continue;
+        }
+
+        if (in_key)
+        {
+            if (c == '=' || c == ':')
+            {
+                in_key = 0;
+                HL_SET(1, HL_NORMAL);
+            }
+            else {
+                HL_SET(1, c == ' ' || c == '\t' ? HL_NORMAL : HL_SPECIAL);
+            }
+            ++i;
+            prev_sep = 1;
+            continue;
+        }
+
+        if ((syn->flags & SYN_NUMBERS) &&
+            ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+             (prev_hl == HL_NUMBER && (isalnum(c) || c == '.'))))
+        {
+            HL_SET(1, HL_NUMBER);
+            ++i;
+            prev_sep = 0;
+            continue;
+        }
+
+        if (prev_sep && !in_pre)
+        {
+            for (k = 0; syn->keywords[k]; ++k)
+            {
+                int kw_len = strlen(syn->keywords[k]);
+                int type = syn->keywords[k][kw_len - 1] == '|';
+                kw_len -= type;
+
+                if (i + kw_len <= len && memcmp(&s[i], syn->keywords[k], kw_len) == 0 &&
+                    (i + kw_len == len || isspace((unsigned char) s[i + kw_len]) ||
+                     strchr(",.()+-/*=~%<>[];:{}&|!", s[i + kw_len]) != NULL))
+                {
+                    HL_SET(kw_len, type ? HL_TYPE : HL_KEYWORD);
+                    i += kw_len;
+                    break;
+                }
+            }
+            if (syn->keywords[k])
+            {
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        HL_SET(1, in_pre ? HL_SPECIAL : HL_NORMAL);
+        prev_sep = isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];:{}&|!", c) != NULL;
+        ++i;
+    }
+
+#undef HL_SET
+
+    st->in_comment = in_comment;
+    st->in_str = in_str;
+    st->in_key = in_key;
+    st->in_pre = in_pre;
+    st->prev_sep = prev_sep;
+    st->prev_hl = prev_hl;
+    st->over = i > to && !st->in_line ? i - to : 0;
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details State the row hands to the next one
+ * 
+ * @param st Scanner state at the end of the row
+ * @param s Row chars
+ * @param len Row Length
+ * @return enum hlState
+ */
+unsigned char editorHlEnd(struct hlRun *st, const char *s, int len) {
+    if (st->in_comment)
+    {
+        return HS_COMMENT;
+    }
+    if (st->in_str && ((conf.syntax->flags & SYN_MLSTRINGS) || (len > 0 && s[len - 1] == '\\')))
+    {
+        return st->in_str == '"' ? HS_DQUOTE : HS_SQUOTE;
+    }
+    return HS_NONE;
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details End state of a row, given the state it starts in
+ * @note A long row keeps the scanner state at each chunk start; rescanning
+ *       starts at the first changed chunk and stops at the first later start
+ *       state that comes out as before
+ * 
+ * @param row Row
+ * @param in State carried in from the row above
+ * @return State at the end of the row
+ */
+unsigned char editorHlRow(erow *row, unsigned char in) {
+    struct hlRun st;
+    int start = 0, k;
+
+    if (row->size > ROW_CHUNK)
+    {
+        editorRowIndex(row);
+    }
+
+    struct rowChunks *ck = ROW_CHUNKS(row);
+    if (ck == NULL)
+    {
+        return editorHlScan(row->chars, row->size, in, NULL);
+    }
+
+    editorHlBegin(&st, in);
+    if (memcmp(&st, &ck->c[0].hl, sizeof(st)) != 0)
+    {
+        ck->c[0].hl = st;
+        ck->hl_from = 0;
+    }
+    if (ck->hl_from >= ck->n)
+    {
+        return row->hl_state;
+    }
+
+    for (k = 0; k < ck->hl_from; ++k)
+    {
+        start += ck->c[k].len;
+    }
+    const char *s = editorRowTail(row, start);
+    for (k = ck->hl_from; k < ck->n; ++k)
+    {
+        st = ck->c[k].hl;
+        editorHlRun(&st, s, row->size, start, start + ck->c[k].len, NULL);
+        start += ck->c[k].len;
+
+        if (k + 1 == ck->n)
+        {
+            break;
+        }
+        if (k + 1 > ck->hl_to && memcmp(&st, &ck->c[k + 1].hl, sizeof(st)) == 0)
+        {
+            ck->hl_from = ck->n;
+            ck->hl_to = -1;
+            return row->hl_state; // the rest of the row saw the same input
+        }
+        ck->c[k + 1].hl = st;
+    }
+
+    ck->hl_from = ck->n;
+    ck->hl_to = -1;
+    int last = row->size > 0;
+    return editorHlEnd(&st, &row->chars[editorRowPos(row, row->size - last)], last); // only the last byte counts
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details Bring the end state of rows [0, at] up to date
+ * @note Walks down from the first changed row and stops as soon as a row ends
+ *       in the state it ended in before, once no changed row is left below:
+ *       the rows after it saw the same input, their cached states still hold
+ * 
+ * @param at Row
+ */
+void editorHlSync(int at) {
+    while (conf.hl_upto <= at && conf.hl_upto < conf.n_rows) {
+        int r = conf.hl_upto;
+        erow *row = editorRowAt(r);
+        unsigned char in = r > 0 ? editorRowAt(r - 1)->hl_state : HS_NONE;
+        unsigned char old = row->hl_state;
+
+        row->hl_state = editorHlRow(row, in);
+        conf.hl_upto++;
+
+        if (r < conf.hl_known && r + 1 >= conf.hl_dirty && row->hl_state == old)
+        {
+            conf.hl_upto = conf.hl_known;
+        }
+    }
+
+    if (conf.hl_upto > conf.hl_known)
+    {
+        conf.hl_known = conf.hl_upto;
+    }
+    if (conf.hl_dirty <= conf.hl_upto)
+    {
+        conf.hl_dirty = 0;
+    }
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details A row's text is about to change
+ * 
+ * @param at Row
+ */
+void editorHlDirty(int at) {
+    if (at >= conf.hl_known)
+    {
+        return;
+    }
+    if (conf.hl_upto < conf.hl_known && conf.hl_upto + 1 > conf.hl_dirty)
+    {
+        conf.hl_dirty = conf.hl_upto + 1; // a walk stopped there, it must resume
+    }
+    if (at < conf.hl_upto)
+    {
+        conf.hl_upto = at;
+    }
+    if (at + 1 > conf.hl_dirty)
+    {
+        conf.hl_dirty = at + 1;
+    }
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details Keep the cached extent in line with a row insert / removal
+ * @note An inserted row starts with the cached state of the row above it,
+ *       the one the row below was computed from
+ * 
+ * @param at Row inserted / removed
+ * @param delta 1 / -1
+ */
+void editorHlShift(int at, int delta) {
+    if (at >= conf.hl_known)
+    {
+        return;
+    }
+    if (delta > 0)
+    {
+        editorRowAt(at)->hl_state = at > 0 ? editorRowAt(at - 1)->hl_state : HS_NONE;
+    }
+
+    int walk = conf.hl_upto < conf.hl_known;
+    int front = conf.hl_upto + (at < conf.hl_upto ? delta : 0);
+
+    conf.hl_known += delta;
+    if (at < conf.hl_dirty)
+    {
+        conf.hl_dirty += delta;
+    }
+    if (walk && front + 1 > conf.hl_dirty)
+    {
+        conf.hl_dirty = front + 1;
+    }
+    if (conf.hl_upto > conf.hl_known)
+    {
+        conf.hl_upto = conf.hl_known;
+    }
+    editorHlDirty(at);
+}
+
+/**
+ * @brief Syntax Highlighting
+ * @details ANSI foreground colour of a class
+ * 
+ * @param hl enum hlType
+ * @return SGR code
+ */
+int editorHlColor(int hl) {
+    switch (hl) {
+        case HL_COMMENT:
+            return 36;
+        case HL_KEYWORD:
+            return 33;
+        case HL_TYPE:
+            return 32;
+        case HL_STRING:
+            return 35;
+        case HL_NUMBER:
+            return 31;
+        case HL_SPECIAL:
+            return 34;
+        default:
+            return 39;
+    }
+}
+
+/**
+ * @brief Regex
+ * @details Compile a pattern into the NFA of its reverse
+ * @note Syntax: . [] [^] * + ? | () \d \w \s (and upper-case negations),
+ *       leading ^ and trailing $. The NFA is reversed so that scanning a row
+ *       backwards finds every match start in one pass, see regexStarts
+ * 
+ * @param re Regex, its storage is reused
+ * @param pat Pattern
+ * @return success/syntax error: 0/-1
+ */
+int regexCompile(struct regex *re, const char *pat) {
+    static unsigned int ids = 0;
+    const char *end = pat + strlen(pat);
+    int out, start;
+
+    re->n_st = 0;
+    re->bol = pat[0] == '^';
+    re->eol = end > pat + re->bol && end[-1] == '$' && (end - 1 == pat || end[-2] != '\\');
+    re->id = ++ids;
+
+    pat += re->bol;
+    end -= re->eol;
+
+    start = regexAlt(re, &pat, end, &out);
+    if (start < 0 || pat != end)
+    {
+        return -1; // includes an unmatched ')'
+    }
+
+    regexPatch(re, out, regexNew(re, RE_MATCH));
+    re->start = start;
+    return 0;
+}
+
+/**
+ * @brief Regex
+ * @details New NFA state, its outs dangling
+ * 
+ * @param re Regex
+ * @param type enum reType
+ * @return State index
+ */
+int regexNew(struct regex *re, int type) {
+    if (re->n_st == re->st_cap)
+    {
+        re->st_cap = re->st_cap ? re->st_cap * 2 : 64;
+        re->st = realloc(re->st, sizeof(struct reState) * re->st_cap);
+    }
+
+    struct reState *st = &re->st[re->n_st];
+    st->type = type;
+    st->out1 = -1;
+    st->out2 = -1;
+    memset(st->cls, 0, sizeof(st->cls));
+    return re->n_st++;
+}
+
+/**
+ * @brief Regex
+ * @details Point every out on a dangling list at a state
+ * @note A list entry is state * 2 + (out2 ? 1 : 0), chained through the outs
+ * 
+ * @param re Regex
+ * @param list Dangling list, -1: empty
+ * @param to Target state
+ */
+void regexPatch(struct regex *re, int list, int to) {
+    while (list >= 0) {
+        int *out = list & 1 ? &re->st[list >> 1].out2 : &re->st[list >> 1].out1;
+        list = *out;
+        *out = to;
+    }
+}
+
+/**
+ * @brief Regex
+ * @details Concatenate two dangling lists
+ * 
+ * @param re Regex
+ * @param a List
+ * @param b List
+ * @return Joined list
+ */
+int regexJoin(struct regex *re, int a, int b) {
+    int list = a;
+
+    if (a < 0)
+    {
+        return b;
+    }
+
+    while (1) {
+        int *out = list & 1 ? &re->st[list >> 1].out2 : &re->st[list >> 1].out1;
+        if (*out < 0)
+        {
+            *out = b;
+            return a;
+        }
+        list = *out;
+    }
+}
+
+/**
+ * @brief Regex
+ * @details alt := cat ('|' cat)*
+ * 
+ * @param re Regex
+ * @param p Parse position
+ * @param end Pattern end
+ * @param out Dangling list of the fragment
+ * @return Fragment start or -1
+ */
+int regexAlt(struct regex *re, const char **p, const char *end, int *out) {
+    int start = regexCat(re, p, end, out);
+
+    while (start >= 0 && *p < end && **p == '|') {
+        int out2;
+        ++*p;
+        int start2 = regexCat(re, p, end, &out2);
+        if (start2 < 0)
+        {
+            return -1;
+        }
+
+        int split = regexNew(re, RE_SPLIT);
+        re->st[split].out1 = start;
+        re->st[split].out2 = start2;
+        start = split;
+        *out = regexJoin(re, *out, out2);
+    }
+    return start;
+}
+
+/**
+ * @brief Regex
+ * @details cat := repeat*, built back to front (reversed NFA)
+ * 
+ * @param re Regex
+ * @param p Parse position
+ * @param end Pattern end
+ * @param out Dangling list of the fragment
+ * @return Fragment start or -1
+ */
+int regexCat(struct regex *re, const char **p, const char *end, int *out) {
+    int start = regexNew(re, RE_EPS);
+
+    *out = start << 1;
+    while (*p < end && **p != '|' && **p != ')') {
+        int out2;
+        int start2 = regexRepeat(re, p, end, &out2);
+        if (start2 < 0)
+        {
+            return -1;
+        }
+
+        regexPatch(re, out2, start);
+        start = start2;
+    }
+    return start;
+}
+
+/**
+ * @brief Regex
+ * @details repeat := atom ('*' | '+' | '?')*
+ * 
+ * @param re Regex
+ * @param p Parse position
+ * @param end Pattern end
+ * @param out Dangling list of the fragment
+ * @return Fragment start or -1
+ */
+int regexRepeat(struct regex *re, const char **p, const char *end, int *out) {
+    int start = regexAtom(re, p, end, out);
+
+    while (start >= 0 && *p < end && strchr("*+?", **p)) {
+        int split = regexNew(re, RE_SPLIT);
+        re->st[split].out1 = start;
+
+        if (**p == '*')
+        {
+            regexPatch(re, *out, split);
+            start = split;
+            *out = split << 1 | 1;
+        }
+        else if (**p == '+') {
+            regexPatch(re, *out, split);
+            *out = split << 1 | 1;
+        }
+        else {
+            start = split;
+            *out = regexJoin(re, *out, split << 1 | 1);
+        }
+        ++*p;
+    }
+    return start;
+}
+
+/**
+ * @brief Regex
+ * @details atom := '(' alt ')' | '[' class ']' | '.' | '\' escape | byte
+ * 
+ * @param re Regex
+ * @param p Parse position
+ * @param end Pattern end
+ * @param out Dangling list of the fragment
+ * @return Fragment start or -1
+ */
+int regexAtom(struct regex *re, const char **p, const char *end, int *out) {
+    unsigned char c = *(*p)++;
+
+    if (c == '(')
+    {
+        int start = regexAlt(re, p, end, out);
+        if (start < 0 || *p == end || **p != ')')
+        {
+            return -1;
+        }
+        ++*p;
+        return start;
+    }
+    if (c == '*' || c == '+' || c == '?')
+    {
+        return -1; // nothing to repeat
+    }
+
+    int st = regexNew(re, RE_CHAR);
+    unsigned char *cls = re->st[st].cls;
+    *out = st << 1;
+
+    if (c == '.')
+    {
+        memset(cls, 0xff, 32);
+    }
+    else if (c == '[') {
+        if (regexClass(cls, p, end) < 0)
+        {
+            return -1;
+        }
+    }
+    else if (c == '\\') {
+        if (*p == end)
+        {
+            return -1;
+        }
+        regexEscape(cls, (unsigned char) *(*p)++);
+    }
+    else {
+        cls[c >> 3] |= 1 << (c & 7);
+    }
+    return st;
+}
+
+/**
+ * @brief Regex
+ * @details Add the bytes of an escape (\d \w \s \D \W \S \t, else literal)
+ * 
+ * @param cls Byte set
+ * @param c Byte after the backslash
+ * @return Byte it stands for when it is a single one, -1 for a set
+ */
+int regexEscape(unsigned char *cls, int c) {
+    unsigned char set[32];
+    int i, neg = isupper(c);
+
+    switch (tolower(c)) {
+        case 'd':
+        case 'w':
+        case 's':
+            memset(set, 0, sizeof(set));
+            for (i = 0; i < 256; ++i)
+            {
+                int in = tolower(c) == 'd' ? (i >= '0' && i <= '9') :
+                         tolower(c) == 's' ? (i == ' ' || (i >= '\t' && i <= '\r')) :
+                         (i < 128 && (isalnum(i) || i == '_'));
+                if (in != neg)
+                {
+                    set[i >> 3] |= 1 << (i & 7);
+                }
+            }
+            for (i = 0; i < 32; ++i)
+            {
+                cls[i] |= set[i];
+            }
+            return -1;
+    }
+
+    if (c == 't')
+    {
+        c = '\t';
+    }
+    cls[c >> 3] |= 1 << (c & 7);
+    return c;
+}
+
+/**
+ * @brief Regex
+ * @details Parse a bracket expression after its '['
+ * 
+ * @param cls Byte set
+ * @param p Parse position
+ * @param end Pattern end
+ * @return success/unterminated: 0/-1
+ */
+int regexClass(unsigned char *cls, const char **p, const char *end) {
+    int i, neg = 0, first = 1;
+
+    if (*p < end && **p == '^')
+    {
+        neg = 1;
+        ++*p;
+    }
+
+    while (*p < end && (**p != ']' || first)) {
+        int lo = (unsigned char) *(*p)++;
+        first = 0;
+
+        if (lo == '\\')
+        {
+            if (*p == end)
+            {
+                return -1;
+            }
+            lo = regexEscape(cls, (unsigned char) *(*p)++);
+            if (lo < 0)
+            {
+                continue;
+            }
+        }
+
+        int hi = lo;
+        if (*p + 1 < end && **p == '-' && (*p)[1] != ']')
+        {
+            hi = (unsigned char) (*p)[1];
+            *p += 2;
+        }
+        for (i = lo; i <= hi; ++i)
+        {
+            cls[i >> 3] |= 1 << (i & 7);
+        }
+    }
+
+    if (*p == end)
+    {
+        return -1;
+    }
+    ++*p;
+
+    if (neg)
+    {
+        for (i = 0; i < 32; ++i)
+        {
+            cls[i] = ~cls[i];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Regex
+ * @details Drop every cached state, (re)size the scratch for a regex
+ * 
+ * @param dfa DFA
+ * @param re Regex
+ */
+void regexDfaReset(struct regexDfa *dfa, struct regex *re) {
+    int i;
+
+    if (dfa->s == NULL)
+    {
+        dfa->s = malloc(sizeof(struct reDfaState) * REGEX_DFA_MAX);
+        dfa->hash = malloc(sizeof(int) * REGEX_DFA_MAX * 2);
+        dfa->n = 0;
+    }
+    if (dfa->alloc < re->n_st)
+    {
+        dfa->alloc = re->n_st;
+        dfa->mark = realloc(dfa->mark, sizeof(int) * dfa->alloc);
+        dfa->stack = realloc(dfa->stack, sizeof(int) * (dfa->alloc * 2 + 1));
+        dfa->buf = realloc(dfa->buf, sizeof(int) * dfa->alloc);
+        dfa->stamp = 0;
+    }
+    if (dfa->stamp == 0)
+    {
+        memset(dfa->mark, 0, sizeof(int) * dfa->alloc);
+    }
+
+    for (i = 0; i < dfa->n; ++i)
+    {
+        free(dfa->s[i].set);
+    }
+    for (i = 0; i < REGEX_DFA_MAX * 2; ++i)
+    {
+        dfa->hash[i] = -1;
+    }
+    dfa->n = 0;
+    dfa->flushes++;
+    dfa->id = re->id;
+}
+
+/**
+ * @brief Regex
+ * @details Add the RE_CHAR / RE_MATCH states reachable from s to dfa->buf
+ * 
+ * @param dfa DFA
+ * @param re Regex
+ * @param s NFA state
+ */
+void regexClosure(struct regexDfa *dfa, struct regex *re, int s) {
+    int sp = 0;
+
+    dfa->stack[sp++] = s;
+    while (sp) {
+        s = dfa->stack[--sp];
+        if (s < 0 || dfa->mark[s] == dfa->stamp)
+        {
+            continue;
+        }
+        dfa->mark[s] = dfa->stamp;
+
+        struct reState *st = &re->st[s];
+        if (st->type == RE_CHAR || st->type == RE_MATCH)
+        {
+            dfa->buf[dfa->n_buf++] = s;
+        }
+        else {
+            dfa->stack[sp++] = st->out1;
+            dfa->stack[sp++] = st->out2;
+        }
+    }
+}
+
+/**
+ * @brief Regex
+ * @details Look up (or cache) the DFA state for the set in dfa->buf
+ * @note Flushes the whole cache when it is full, which bounds memory on
+ *       any input; callers must not hold state indices across this call
+ * 
+ * @param dfa DFA
+ * @param re Regex
+ * @return DFA state index
+ */
+int regexDfaAdd(struct regexDfa *dfa, struct regex *re) {
+    int i, n = dfa->n_buf;
+    unsigned int h = 2166136261u;
+
+    // stamps mark membership, so the set comes out unordered: sort it
+    for (i = 1; i < n; ++i)
+    {
+        int v = dfa->buf[i], j = i;
+        while (j > 0 && dfa->buf[j - 1] > v) {
+            dfa->buf[j] = dfa->buf[j - 1];
+            --j;
+        }
+        dfa->buf[j] = v;
+    }
+    for (i = 0; i < n; ++i)
+    {
+        h = (h ^ dfa->buf[i]) * 16777619u;
+    }
+
+    unsigned int slot = h & (REGEX_DFA_MAX * 2 - 1);
+    while (dfa->hash[slot] >= 0) {
+        struct reDfaState *d = &dfa->s[dfa->hash[slot]];
+        if (d->n == n && memcmp(d->set, dfa->buf, sizeof(int) * n) == 0)
+        {
+            return dfa->hash[slot];
+        }
+        slot = (slot + 1) & (REGEX_DFA_MAX * 2 - 1);
+    }
+
+    if (dfa->n == REGEX_DFA_MAX)
+    {
+        regexDfaReset(dfa, re);
+        slot = h & (REGEX_DFA_MAX * 2 - 1);
+    }
+
+    struct reDfaState *d = &dfa->s[dfa->n];
+    d->set = malloc(sizeof(int) * (n ? n : 1));
+    memcpy(d->set, dfa->buf, sizeof(int) * n);
+    d->n = n;
+    d->match = 0;
+    for (i = 0; i < n; ++i)
+    {
+        d->match |= re->st[d->set[i]].type == RE_MATCH;
+    }
+    for (i = 0; i < 256; ++i)
+    {
+        d->next[i] = -1;
+    }
+
+    dfa->hash[slot] = dfa->n;
+    return dfa->n++;
+}
+
+/**
+ * @brief Regex
+ * @details Transition on one byte, computed from the NFA on a cache miss
+ * @note Without $ the NFA start joins every set: an implicit leading .*
+ *       (trailing, in the reversed pattern)
+ * 
+ * @param dfa DFA
+ * @param re Regex
+ * @param cur DFA state, -1 for the start state
+ * @param c Byte
+ * @return Next DFA state
+ */
+int regexDfaNext(struct regexDfa *dfa, struct regex *re, int cur, unsigned char c) {
+    int i;
+
+    if (++dfa->stamp == 0)
+    {
+        memset(dfa->mark, 0, sizeof(int) * dfa->alloc);
+        dfa->stamp = 1;
+    }
+    dfa->n_buf = 0;
+
+    if (cur < 0)
+    {
+        regexClosure(dfa, re, re->start);
+        return regexDfaAdd(dfa, re);
+    }
+
+    struct reDfaState *d = &dfa->s[cur];
+    for (i = 0; i < d->n; ++i)
+    {
+        struct reState *st = &re->st[d->set[i]];
+        if (st->type == RE_CHAR && (st->cls[c >> 3] & (1 << (c & 7))))
+        {
+            regexClosure(dfa, re, st->out1);
+        }
+    }
+    if (!re->eol)
+    {
+        regexClosure(dfa, re, re->start);
+    }
+
+    int flushes = dfa->flushes;
+    int next = regexDfaAdd(dfa, re);
+    if (dfa->flushes == flushes)
+    {
+        dfa->s[cur].next[c] = next;
+    }
+    return next;
+}
+
+/**
+ * @brief Regex
+ * @details Every position a match starts at, in one backward pass over a row
+ * @note Linear in the row length, no backtracking
+ * 
+ * @param re Regex
+ * @param dfa DFA cache of the calling thread
+ * @param s Row chars
+ * @param len Row Length
+ * @param starts Result buffer, grown as needed
+ * @param cap Result buffer capacity
+ * @return Number of starts, ascending in *starts
+ */
+int regexStarts(struct regex *re, struct regexDfa *dfa, const char *s, int len, int **starts, int *cap) {
+    int i, n = 0;
+
+    if (dfa->s == NULL || dfa->id != re->id)
+    {
+        regexDfaReset(dfa, re);
+    }
+
+    int cur = regexDfaNext(dfa, re, -1, 0);
+    for (i = len; i >= 0; --i)
+    {
+        if (i < len)
+        {
+            int next = dfa->s[cur].next[(unsigned char) s[i]];
+            cur = next >= 0 ? next : regexDfaNext(dfa, re, cur, s[i]);
+            if (dfa->s[cur].n == 0)
+            {
+                break; // dead, only possible with $
+            }
+        }
+
+        if (dfa->s[cur].match && (!re->bol || i == 0))
+        {
+            if (n == *cap)
+            {
+                *cap = *cap ? *cap * 2 : 64;
+                *starts = realloc(*starts, sizeof(int) * *cap);
+            }
+            (*starts)[n++] = i;
+        }
+    }
+
+    for (i = 0; i < n / 2; ++i)
+    {
+        int t = (*starts)[i];
+        (*starts)[i] = (*starts)[n - 1 - i];
+        (*starts)[n - 1 - i] = t;
+    }
+    return n;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Map the file, index nothing yet: opening is O(1) whatever the size
+ * 
+ * @param file_name File to view
+ */
+void editorViewOpen(char *file_name) {
+    free(conf.file_name);
+    conf.file_name = strdup(file_name);
+    conf.viewer = 1;
+
+    int fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+    {
+        texTerminate("open");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        texTerminate("fstat");
+    }
+
+    struct viewIndex *v = &conf.view;
+    v->n_ckpt = 0;
+    v->stride = VIEW_STRIDE_MIN;
+    v->scan = 0;
+    v->done = st.st_size == 0;
+    v->lines = 0;
+    v->floating = 0;
+    v->win = NULL;
+    v->win_n = 0;
+    v->win_cap = 0;
+    v->cur_line = -1;
+    v->next_slot = 0;
+
+    int i;
+    for (i = 0; i < VIEW_SLOTS; ++i)
+    {
+        v->slot_line[i] = -1;
+        v->slot[i].ext = NULL;
+    }
+
+    if (st.st_size > 0)
+    {
+        conf.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (conf.map == MAP_FAILED)
+        {
+            texTerminate("mmap");
+        }
+        conf.map_len = st.st_size;
+    }
+    close(fd);
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Extend the line index until line at is known (or EOF)
+ * @note While floating only the window grows, see editorViewGrow
+ * 
+ * @param at Line wanted
+ */
+void editorViewIndex(int at) {
+    struct viewIndex *v = &conf.view;
+
+    if (v->floating)
+    {
+        editorViewGrow(at);
+        return;
+    }
+
+    while (!v->done && v->lines <= at) {
+        editorViewStep();
+    }
+    conf.n_rows = v->lines;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Index one more line
+ * @note Keeps one checkpoint per stride lines; when the table is full every
+ *       other checkpoint is dropped and the stride doubles
+ */
+void editorViewStep() {
+    struct viewIndex *v = &conf.view;
+    char *end = conf.map + conf.map_len;
+
+    if (v->lines % v->stride == 0)
+    {
+        if (v->n_ckpt == VIEW_CKPT_MAX)
+        {
+            int i;
+            for (i = 0; i < VIEW_CKPT_MAX / 2; ++i)
+            {
+                v->ckpt[i] = v->ckpt[2 * i];
+            }
+            v->n_ckpt = VIEW_CKPT_MAX / 2;
+            v->stride *= 2;
+        }
+        if (v->lines % v->stride == 0)
+        {
+            v->ckpt[v->n_ckpt++] = v->scan;
+        }
+    }
+
+    char *nl = memchr(conf.map + v->scan, '\n', end - (conf.map + v->scan));
+    v->scan = nl ? (size_t) (nl + 1 - conf.map) : conf.map_len;
+    v->lines++;
+    v->done = v->scan == conf.map_len;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Index the whole file, line numbers are exact afterwards
+ */
+void editorViewAll() {
+    struct viewIndex *v = &conf.view;
+
+    while (!v->done) {
+        editorViewStep();
+    }
+
+    if (v->floating)
+    {
+        editorViewSettle();
+    }
+    else {
+        conf.n_rows = v->lines;
+    }
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Line number of an indexed line start
+ * @note Binary search of the checkpoints, then at most one stride of lines
+ * 
+ * @param off Line start, below the index scan
+ * @return Line
+ */
+int editorViewLineOf(size_t off) {
+    struct viewIndex *v = &conf.view;
+    int lo = 0, hi = v->n_ckpt;
+
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (v->ckpt[mid] <= off)
+        {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    int line = lo * v->stride;
+    size_t at = v->ckpt[lo];
+    while (at < off) {
+        char *nl = memchr(conf.map + at, '\n', off - at);
+        if (nl == NULL)
+        {
+            break;
+        }
+        at = nl + 1 - conf.map;
+        ++line;
+    }
+    return line;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Byte offset to the next line start, or the last line when there
+ *          is none
+ * 
+ * @param off Offset in conf.map
+ * @return Line start
+ */
+size_t editorViewResync(size_t off) {
+    if (off > 0 && off < conf.map_len && conf.map[off - 1] != '\n')
+    {
+        char *nl = memchr(conf.map + off, '\n', conf.map_len - off);
+        off = nl ? (size_t) (nl + 1 - conf.map) : conf.map_len;
+    }
+
+    if (off >= conf.map_len)
+    {
+        // back from the end, over a trailing newline, to the last line start
+        off = conf.map_len;
+        if (conf.map[off - 1] == '\n')
+        {
+            --off;
+        }
+        while (off > 0 && conf.map[off - 1] != '\n') {
+            --off;
+        }
+    }
+    return off;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Put the cursor on the line starting at off, on screen line line
+ * @note O(screen) past the index: the view floats on a window of line starts
+ *       read around off, line numbers stay unknown until editorViewPoll
+ *       catches up
+ * 
+ * @param off Line start (< conf.map_len)
+ * @param line Screen line wanted for it
+ */
+void editorViewSeek(size_t off, int line) {
+    struct viewIndex *v = &conf.view;
+
+    if (off < v->scan || v->done)
+    {
+        int y = editorViewLineOf(off);
+        if (v->floating)
+        {
+            editorViewDrop(-1);
+        }
+        editorJump(y, line);
+        return;
+    }
+
+    if (v->win_cap == 0)
+    {
+        v->win_cap = 256;
+        v->win = malloc(sizeof(size_t) * v->win_cap);
+    }
+    v->floating = 1;
+    v->win[0] = off;
+    v->win_n = 1;
+    v->win_eof = 0;
+    editorViewForget();
+
+    conf.cur_y = 0;
+    conf.off_row = 0;
+    editorViewGrow(2 * conf.dispRows);
+    editorViewBack(line + 2 * conf.dispRows);
+
+    conf.off_row = conf.cur_y > line ? conf.cur_y - line : 0;
+    conf.cur_x = utilRen2Cur(editorRowAt(conf.cur_y), conf.ren_x);
+    editorViewSettle();
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Floating: read line starts below the window until row at is there
+ * 
+ * @param at Row wanted
+ */
+void editorViewGrow(int at) {
+    struct viewIndex *v = &conf.view;
+    char *end = conf.map + conf.map_len;
+
+    while (!v->win_eof && v->win_n <= at) {
+        size_t off = v->win[v->win_n - 1];
+        char *nl = memchr(conf.map + off, '\n', end - (conf.map + off));
+        if (nl == NULL || nl + 1 == end)
+        {
+            v->win_eof = 1;
+            break;
+        }
+
+        if (v->win_n == v->win_cap)
+        {
+            v->win_cap *= 2;
+            v->win = realloc(v->win, sizeof(size_t) * v->win_cap);
+        }
+        v->win[v->win_n++] = nl + 1 - conf.map;
+    }
+    conf.n_rows = v->win_n;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Floating: read up to n line starts above the window
+ * @note Rows are renumbered, the cursor and view offset move with them
+ * 
+ * @param n Lines wanted
+ */
+void editorViewBack(int n) {
+    struct viewIndex *v = &conf.view;
+
+    if (n <= 0 || v->win[0] == 0)
+    {
+        return;
+    }
+
+    if (v->win_n + n > v->win_cap)
+    {
+        while (v->win_n + n > v->win_cap) {
+            v->win_cap *= 2;
+        }
+        v->win = realloc(v->win, sizeof(size_t) * v->win_cap);
+    }
+    memmove(v->win + n, v->win, sizeof(size_t) * v->win_n);
+
+    // fill upwards from just above the old top, close the hole if the file starts first
+    int k;
+    size_t off = v->win[n];
+    for (k = 0; k < n && off > 0; ++k)
+    {
+        --off; // the newline ending the line above
+        while (off > 0 && conf.map[off - 1] != '\n') {
+            --off;
+        }
+        v->win[n - 1 - k] = off;
+    }
+    if (k < n)
+    {
+        memmove(v->win, v->win + n - k, sizeof(size_t) * (v->win_n + k));
+    }
+    v->win_n += k;
+
+    conf.n_rows = v->win_n;
+    conf.cur_y += k;
+    conf.off_row += k;
+    editorViewForget();
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Floating: back to exact line numbers once they are known, that is
+ *          when the window starts the file or the index got to it
+ */
+void editorViewSettle() {
+    struct viewIndex *v = &conf.view;
+
+    if (!v->floating || (v->win[0] > 0 && v->win[0] >= v->scan && !v->done))
+    {
+        return;
+    }
+
+    editorViewDrop(v->win[0] > 0 ? editorViewLineOf(v->win[0]) : 0);
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Leave the floating window for the line index
+ * 
+ * @param first Line of the window top, -1 unknown: the cursor goes home
+ */
+void editorViewDrop(int first) {
+    struct viewIndex *v = &conf.view;
+
+    v->floating = 0;
+    v->cur_line = -1;
+    editorViewForget();
+
+    if (first < 0)
+    {
+        conf.cur_y = 0;
+        conf.cur_x = 0;
+        conf.off_row = 0;
+        editorViewIndex(0);
+        return;
+    }
+
+    conf.cur_y += first;
+    conf.off_row += first;
+    editorViewIndex(conf.cur_y + 2 * conf.dispRows);
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Idle tick while floating: index for VIEW_POLL_MS, then try to
+ *          settle on exact line numbers
+ */
+void editorViewPoll() {
+    struct viewIndex *v = &conf.view;
+    long long t0 = utilClockMs();
+
+    while (!v->done && v->scan <= v->win[0] && utilClockMs() - t0 < VIEW_POLL_MS) {
+        int i;
+        for (i = 0; i < 4096 && !v->done && v->scan <= v->win[0]; ++i)
+        {
+            editorViewStep();
+        }
+    }
+    editorViewSettle();
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Rows got renumbered: the row slots no longer match
+ */
+void editorViewForget() {
+    int i;
+
+    for (i = 0; i < VIEW_SLOTS; ++i)
+    {
+        conf.view.slot_line[i] = -1;
+    }
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Locate an indexed line: sequential steps are O(1), jumps walk at
+ *          most one stride from the nearest checkpoint
+ * 
+ * @param at Line (< conf.n_rows)
+ * @param len Line Length, CR/LF stripped
+ * @return Line offset in conf.map
+ */
+size_t editorViewLine(int at, int *len) {
+    struct viewIndex *v = &conf.view;
+    char *end = conf.map + conf.map_len;
+    int line;
+    size_t off;
+
+    if (v->floating)
+    {
+        off = v->win[at];
+    }
+    else {
+        if (v->cur_line >= 0 && at >= v->cur_line && at - v->cur_line < v->stride)
+        {
+            line = v->cur_line;
+            off = v->cur_off;
+        }
+        else {
+            line = (at / v->stride) * v->stride;
+            off = v->ckpt[at / v->stride];
+        }
+
+        while (line < at) {
+            char *nl = memchr(conf.map + off, '\n', end - (conf.map + off));
+            off = nl + 1 - conf.map;
+            ++line;
+        }
+
+        v->cur_line = at;
+        v->cur_off = off;
+    }
+
+    char *nl = memchr(conf.map + off, '\n', end - (conf.map + off));
+    size_t line_len = (nl ? nl : end) - (conf.map + off);
+    while (line_len > 0 && conf.map[off + line_len - 1] == '\r')
+      line_len--;
+
+    *len = line_len;
+    return off;
+}
+
+/**
+ * @brief Read-only Viewer
+ * @details Row view of one line, kept in a small slot cache
+ * @note Only rows actually shown or visited get indexed
+ * 
+ * @param at Line (< conf.n_rows)
+ * @return Row, valid until VIEW_SLOTS other lines are requested
+ */
+erow *editorViewRow(int at) {
+    struct viewIndex *v = &conf.view;
+    int i;
+
+    for (i = 0; i < VIEW_SLOTS; ++i)
+    {
+        if (v->slot_line[i] == at)
+        {
+            return &v->slot[i];
+        }
+    }
+
+    erow *row = &v->slot[v->next_slot];
+    v->slot_line[v->next_slot] = at;
+    v->next_slot = (v->next_slot + 1) % VIEW_SLOTS;
+
+    int len;
+    row->chars = conf.map + editorViewLine(at, &len);
+    row->size = len;
+    row->cap = 0;
+    editorUpdateRow(row);
+
+    return row;
+}
+
+/**
+ * @brief Row control
+ * @details Logical row lookup, skipping over the gap
+ * 
+ * @param at Row index
+ * @return Row pointer, valid until the next insert
+ */
+erow *editorRowAt(int at) {
+    if (conf.viewer)
+    {
+        return editorViewRow(at);
+    }
+
+    if (at >= conf.gap_at)
+    {
+        at += conf.row_cap - conf.n_rows;
+    }
+    return &conf.row[at];
+}
+
+/**
+ * @brief Row control
+ * @details Slide the gap so that it starts at row at
+ * @note Cost is the distance travelled, edits near the last one are O(1)
+ * 
+ * @param at Row index
+ */
+void editorRowGapMove(int at) {
+    int gap = conf.row_cap - conf.n_rows;
+
+    if (at < conf.gap_at)
+    {
+        memmove(&conf.row[at + gap], &conf.row[at], sizeof(erow) * (conf.gap_at - at) );
+    }
+    else if (at > conf.gap_at) {
+        memmove(&conf.row[conf.gap_at], &conf.row[conf.gap_at + gap], sizeof(erow) * (at - conf.gap_at) );
+    }
+    conf.gap_at = at;
+}
+
+/**
+ * @brief Row control
+ * @details Open an uninitialised row at index at
+ * 
+ * @param at Row index
+ * @return New row, caller fills every field
+ */
+erow *editorRowSlot(int at) {
+    editorRowReserve(1);
+    editorRowGapMove(at);
+    conf.gap_at++;
+    conf.n_rows++;
+    editorHlShift(at, 1);
+
+    return &conf.row[at];
+}
+
+/**
+ * @brief Row control
+ * @details Make room for n more rows, growing capacity geometrically
+ * 
+ * @param n Rows about to be inserted
+ */
+void editorRowReserve(int n) {
+    editorGapClose(); // rows are about to move, and the gap points at one
+
+    if (conf.row_cap - conf.n_rows >= n)
+    {
+        return;
+    }
+
+    int tail = conf.n_rows - conf.gap_at;
+    int old_cap = conf.row_cap;
+    int new_cap = old_cap ? old_cap * 2 : ROW_GAP_MIN;
+
+    if (new_cap < conf.n_rows + n)
+    {
+        new_cap = conf.n_rows + n;
+    }
+
+    conf.row = realloc(conf.row, sizeof(erow) * new_cap);
+    memmove(&conf.row[new_cap - tail], &conf.row[old_cap - tail], sizeof(erow) * tail);
+    conf.row_cap = new_cap;
+}
+
+/**
+ * @brief Row control
+ * @details Copy-on-write, give a mapped or snapshot-shared row its own heap chars
+ * 
+ * @param row Row about to be modified
+ */
+void editorRowOwn(erow *row) {
+    utilRowReserve(row, row->size + 1);
+}
+
+/**
+ * @brief Row control
+ * @details Chars still referenced by a background save snapshot
+ * 
+ * @param row Row
+ * @return shared/private: 1/0
+ */
+int editorRowShared(erow *row) {
+    return conf.save.active && row->cap && row->ext && row->ext->snap == conf.save.gen;
+}
+
+/**
+ * @brief Row control
+ * @details Give row a gap at byte at with at least one free byte
+ * @note A new gap costs one move of the bytes after at, into all the spare
+ *       capacity; it then only travels as far as the cursor does
+ * 
+ * @param row Long row about to be edited
+ * @param at Byte offset
+ */
+void editorGapOpen(erow *row, int at) {
+    struct rowGap *g = &conf.cgap;
+
+    if (g->row == row && g->len > 0)
+    {
+        editorGapMove(row, at);
+        return;
+    }
+    if (g->row != row)
+    {
+        editorGapClose();
+    }
+
+    utilRowReserve(row, row->size + 2);
+    g->row = row;
+    g->at = at;
+    g->len = row->cap - row->size - 1;
+    memmove(&row->chars[at + g->len], &row->chars[at], row->size - at + 1);
+}
+
+/**
+ * @brief Row control
+ * @details Slide the gap of row to byte at, nothing if row has none
+ * @note Cost is the distance travelled
+ * 
+ * @param row Row
+ * @param at Byte offset
+ */
+void editorGapMove(erow *row, int at) {
+    struct rowGap *g = &conf.cgap;
+
+    if (row != g->row)
+    {
+        return;
+    }
+
+    if (at < g->at)
+    {
+        memmove(&row->chars[at + g->len], &row->chars[at], g->at - at);
+    }
+    else if (at > g->at) {
+        memmove(&row->chars[g->at], &row->chars[g->at + g->len], at - g->at);
+    }
+    g->at = at;
+}
+
+/**
+ * @brief Row control
+ * @details Close the gap, its row is flat again
+ */
+void editorGapClose() {
+    struct rowGap *g = &conf.cgap;
+
+    if (g->row == NULL)
+    {
+        return;
+    }
+
+    erow *row = g->row;
+    memmove(&row->chars[g->at], &row->chars[g->at + g->len], row->size - g->at + 1);
+    g->row = NULL;
+}
+
+/**
+ * @brief Row control
+ * @details Keys that leave the gap in place: typing, deleting and moving the
+ *          cursor. Anything else may read rows whole and closes it first
+ * 
+ * @param c Key
+ * @return keeps/closes: 1/0
+ */
+int editorGapKeeps(int c) {
+    switch(c){
+        case ARR_UP:
+        case ARR_DOWN:
+        case ARR_LEFT:
+        case ARR_RIGHT:
+        case HOME_KEY:
+        case END_KEY:
+        case BKSP_KEY:
+        case CTRL_KEY('h'):
+        case DEL_KEY:
+        case '\t':
+            return 1;
+    }
+    return c >= ' ' && c < 256;
+}
+
+/**
+ * @brief Row control
+ * @details Where byte at of a row sits in its chars
+ * 
+ * @param row Row
+ * @param at Byte offset
+ * @return Index in chars
+ */
+int editorRowPos(erow *row, int at) {
+    if (row == conf.cgap.row && at >= conf.cgap.at)
+    {
+        return at + conf.cgap.len;
+    }
+    return at;
+}
+
+/**
+ * @brief Row control
+ * @details Flat view of the bytes from at to the end of a row
+ * @note Moves a gap in the way back to at
+ * 
+ * @param row Row
+ * @param at Byte offset
+ * @return p, p[i] is byte i for every i >= at
+ */
+char *editorRowTail(erow *row, int at) {
+    if (row != conf.cgap.row)
+    {
+        return row->chars;
+    }
+
+    if (at < conf.cgap.at)
+    {
+        editorGapMove(row, at);
+    }
+    return row->chars + conf.cgap.len;
+}
+
+/**
+ * @brief Row control
+ * @details Bytes [from, to) of a row as they lie in chars, split by the gap
+ * 
+ * @param row Row
+ * @param from First byte
+ * @param to Byte past the last
+ * @param s Out: start of each piece
+ * @param n Out: length of each piece
+ * @return Pieces, 0 to 2
+ */
+int editorRowSpans(erow *row, int from, int to, const char **s, int *n) {
+    int split = row == conf.cgap.row ? conf.cgap.at : to;
+    int k = 0;
+
+    if (from < split && from < to)
+    {
+        s[k] = &row->chars[from];
+        n[k++] = (to < split ? to : split) - from;
+    }
+    if (to > split)
+    {
+        int at = from > split ? from : split;
+        s[k] = &row->chars[at + conf.cgap.len];
+        n[k++] = to - at;
+    }
+    return k;
+}
+
+/**
+ * @brief Row control
+ * @details Copy every mapped row out, then drop the file mapping
+ */
+void editorDetachMap() {
+    if (conf.map == NULL)
+    {
+        return;
+    }
+    editorLoadAll();
+
+    int i;
+    for (i = 0; i < conf.n_rows; ++i)
+    {
+        editorRowOwn(editorRowAt(i));
+    }
+
+    munmap(conf.map, conf.map_len);
+    conf.map = NULL;
+    conf.map_len = 0;
+    conf.load_at = 0;
+}
+
+/**
+ * @brief Parser
+ * @details Append String
+ * 
+ * @param memBuf Dynamic-string Struct
+ * @param s Input String
+ * @param len String Length
+ */
+void memBufAppend(struct memBuf *abuf, const char *s, int len){
+    if (memBufReserve(abuf, len) == -1)
+    {
+        return;
+    }
+
+    memcpy(&abuf->b[abuf->len], s, len);
+    abuf -> len += len;
+}
+
+/**
+ * @brief Parser
+ * @details Append n copies of one char, e.g. padding
+ * 
+ * @param memBuf Dynamic-string Struct
+ * @param c Fill Char
+ * @param n Count
+ */
+void memBufRepeat(struct memBuf *abuf, char c, int n){
+    if (n <= 0 || memBufReserve(abuf, n) == -1)
+    {
+        return;
+    }
+
+    memset(&abuf->b[abuf->len], c, n);
+    abuf -> len += n;
+}
+
+/**
+ * @brief Parser
+ * @details Ensure room for len more bytes, capacity doubles
+ * 
+ * @param memBuf Dynamic-string Struct
+ * @param len Bytes about to be appended
+ * @return valid/invalid: 0/-1
+ */
+int memBufReserve(struct memBuf *abuf, int len){
+    if (abuf->len + len <= abuf->cap)
+    {
+        return 0;
+    }
+
+    int cap = abuf->cap ? abuf->cap * 2 : BUF_MIN;
+    while (cap < abuf->len + len) {
+        cap *= 2;
+    }
+
+    char *new = realloc(abuf -> b, cap);
+
+    if (new == NULL)
+    {
+        return -1;
+    }
+
+    abuf -> b = new;
+    abuf -> cap = cap;
+    return 0;
+}
+
+/**
+ * @brief Parser
+ * @details Empty the buffer, keep its memory
+ * 
+ * @param memBuf Dynamic-string Struct
+ */
+void memBufReset(struct memBuf *abuf){
+    abuf -> len = 0;
+}
+
+/**
+ * @brief Parser
+ * @details Append String
+ * 
+ * @param memBuf Dynamic-string Struct
+ */
+void memBufFree(struct memBuf *abuf){
+    free(abuf->b);
+    abuf -> b = NULL;
+    abuf -> len = 0;
+    abuf -> cap = 0;
+}
+
+/**
+ * @brief Row control
+ * @details Free Memory at Delete
+ * 
+ * @param row Current Row
+ */
+void memFreeRow(erow *row) {
+    if (row == conf.cgap.row)
+    {
+        conf.cgap.row = NULL;
+    }
+    if (editorRowShared(row))
+    {
+        editorSaveGarbage(row->chars);
+    }
+    else if (row->cap) {
+        free(row->chars);
+    }
+    if (row->ext)
+    {
+        free(row->ext->mark);
+        free(row->ext->chunks);
+        free(row->ext);
+    }
+}
+
+/**
+ * @brief Utility for Screen Rending
+ * @details Cursor to Render char count
+ * @note Binary search over the row index, plain bytes past the last mark;
+ *       a long row sums chunks, then scans within one
+ * 
+ * @param row Input Row
+ * @param cur_x Cursor Column
+ * 
+ * @return Render equivalent Column
+ */
+int utilCur2Ren(erow *row, int cur_x) {
+    int lo = 0, hi;
+
+    editorRowIndex(row);
+    if (ROW_CHUNKS(row))
     {
-        conf.off_col = conf.ren_x;
+        const char *s[2];
+        int start, col, n[2], i;
+        editorChunkFind(row, cur_x, &start, &col);
+        int m = editorRowSpans(row, start, cur_x, s, n);
+        for (i = 0; i < m; ++i)
+        {
+            col = utilColAdvance(s[i], n[i], col);
+        }
+        return col;
     }
 
-    if (conf.ren_x >= conf.off_col + conf.dispCols)
+    if (row->ext == NULL)
     {
-        conf.off_col = conf.ren_x - conf.dispCols + 1;
+        return cur_x;
+    }
+
+    struct rowMark *mark = row->ext->mark;
+    hi = row->ext->n_mark;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mark[mid].at <= cur_x)
+        {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
     }
+
+    return lo ? mark[lo - 1].col + (cur_x - mark[lo - 1].at) : cur_x;
 }
 
 /**
- * @brief High-level Editor handling
- * @details Rendering each char, watch for tab
+ * @brief Utility for Screen Rending
+ * @details Render to Cursor char count
+ * @note A column inside a tab or wide char gives the start of that char
  * 
- * @param row File Input line
+ * @param row Input Row
+ * @param ren_x Render Column
+ * 
+ * @return Cursor Column, at most row->size
  */
-void editorUpdateRow(erow *row) {
-    int tabs = 0;
-    int i;
+int utilRen2Cur(erow *row, int ren_x) {
+    int lo = 0, hi;
 
-    for (i = 0; i < row->size; ++i)
+    editorRowIndex(row);
+    if (ROW_CHUNKS(row))
     {
-        if (row->chars[i] == '\t')
+        struct rowChunks *ck = row->ext->chunks;
+        int k = 0, start = 0, col = 0;
+        while (k + 1 < ck->n && editorChunkCol(&ck->c[k], col) <= ren_x) {
+            col = editorChunkCol(&ck->c[k], col);
+            start += ck->c[k].len;
+            ++k;
+        }
+        // either side of a gap in turn
+        const char *s[2];
+        int n[2], i, m = editorRowSpans(row, start, start + ck->c[k].len, s, n);
+        for (i = 0; i < m; ++i)
         {
-            ++tabs;
+            int at = utilColSeek(s[i], n[i], col, ren_x);
+            if (at < n[i] || i + 1 == m)
+            {
+                return start + at;
+            }
+            col = utilColAdvance(s[i], n[i], col);
+            start += n[i];
         }
+        return start;
     }
 
-    free(row ->render);
-    row->render = malloc(row->size + tabs * (TABS_TO_SPACES - 1) + 1);
-
-    int idx = 0;
-    for (i = 0; i < row->size; ++i)
+    if (row->ext == NULL)
     {
+        return ren_x < row->size ? ren_x : row->size;
+    }
 
-        if (row->chars[i] == '\t')
+    struct rowMark *mark = row->ext->mark;
+    int n_mark = row->ext->n_mark;
+    hi = n_mark;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mark[mid].col <= ren_x)
         {
-            row->render[idx++] = ' ';
-            while (idx % TABS_TO_SPACES != 0) {
-                row->render[idx++] = ' ';
-            }
+            lo = mid + 1;
         }
         else {
-            row->render[idx++] = row->chars[i];
+            hi = mid;
         }
     }
-    row->render[idx] = '\0';
-    row->ren_sz = idx;
+
+    int at = lo ? mark[lo - 1].at : 0;
+    int col = lo ? mark[lo - 1].col : 0;
+    int stop = lo < n_mark ? utilUtf8Prev(row->chars, mark[lo].at) : row->size;
+
+    return at + (ren_x - col) < stop ? at + (ren_x - col) : stop;
 }
 
 /**
- * @brief User Input Handling
- * @details Invoke util to insert Char to row
+ * @brief Utility for Screen Rending
+ * @details Column reached after some text
+ * @note Pure ASCII text only looks for tabs, with memchr
  * 
- * @param c Input Character
+ * @param s Text
+ * @param len Length
+ * @param col Column s starts at
+ * @return Column after s
  */
-void editorInputChar(int c) {
-    if (conf.cur_y == conf.n_rows)
+int utilColAdvance(const char *s, int len, int col) {
+    const char *p = s, *end = s + len, *tab;
+
+    if (utilIsAscii(s, len))
     {
-        editorAppendChar(conf.n_rows,"", 0);
+        while ((tab = memchr(p, '\t', end - p)) != NULL) {
+            col += tab - p;
+            col += TABS_TO_SPACES - (col % TABS_TO_SPACES);
+            p = tab + 1;
+        }
+        return col + (end - p);
     }
-    utilCharInsert(&conf.row[conf.cur_y], conf.cur_x, c);
-    ++conf.cur_x;
+
+    while (p < end) {
+        int w;
+        p += utilCharNext(p, end - p, col, &w);
+        col += w;
+    }
+    return col;
 }
 
 /**
- * @brief User Input Handling
- * @details Invoke util to delete Char from row
+ * @brief Utility for Screen Rending
+ * @details Byte of the char covering a column
+ * @note Pure ASCII text only looks for tabs, with memchr
+ * 
+ * @param s Text
+ * @param len Length
+ * @param col Column s starts at
+ * @param ren_x Column looked for
+ * @return Offset in s, len when ren_x lies past the end
  */
-void editorRemoveChar() {
-    if (conf.cur_y == conf.n_rows)
+int utilColSeek(const char *s, int len, int col, int ren_x) {
+    int i = 0, w;
+
+    if (utilIsAscii(s, len))
     {
-        return;
+        const char *tab;
+        while ((tab = memchr(s + i, '\t', len - i)) != NULL) {
+            int run = tab - (s + i);
+            if (col + run > ren_x)
+            {
+                return i + (ren_x - col);
+            }
+            col += run;
+            i += run;
+            w = TABS_TO_SPACES - (col % TABS_TO_SPACES);
+            if (col + w > ren_x)
+            {
+                return i;
+            }
+            col += w;
+            ++i;
+        }
+        return i + (ren_x - col) < len ? i + (ren_x - col) : len;
     }
 
-    if (conf.cur_x == 0 && conf.cur_y == 0)
-    {
-        return;
+    while (i < len) {
+        int n = utilCharNext(&s[i], len - i, col, &w);
+        if (col + w > ren_x)
+        {
+            return i;
+        }
+        i += n;
+        col += w;
     }
+    return len;
+}
 
-    erow *row = &conf.row[conf.cur_y];
+/**
+ * @brief Utility for Row Rending
+ * @details Insert input char
+ * 
+ * @param row Current Row
+ * @param at Cursor Position
+ * @param c ASCII coded char
+ */ 
+void utilCharInsert(erow *row, int at, int c) {
+    if (at < 0 || at > row->size)
+    {
+        at = row->size;
+    }
 
-    if (conf.cur_x > 0)
+    if (row == conf.cgap.row || (row->indexed && ROW_CHUNKS(row)))
     {
-        utilCharDel(row, conf.cur_x - 1);
-        --conf.cur_x;
+        // long row: into the gap, which only moves as far as the cursor did
+        editorGapOpen(row, at);
+        row->chars[at] = c;
+        conf.cgap.at++;
+        conf.cgap.len--;
     }
     else {
-        conf.cur_x = conf.row[conf.cur_y - 1].size;
-        editorAppendString(&conf.row[conf.cur_y - 1], row->chars, row->size);
-        editorRemoveRow(conf.cur_y);
-        --conf.cur_y;
+        utilRowReserve(row, row->size + 2);
+        memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+        row->chars[at] = c;
     }
+    ++row->size;
+    editorRowPatch(row, at, 1);
+    conf.mod++;
 }
 
 /**
- * @brief User Input Handling
- * @details Invoke util to delete entire Row
+ * @brief Utility for Row Rending
+ * @details Remove chars at buffer
  * 
- * @param at Current Row
+ * @param row Current Row
+ * @param at Cursor Position
+ * @param n Byte count, a whole UTF-8 sequence
  */
-void editorRemoveRow(int at) {
-    if (at < 0 || at >= conf.n_rows)
+void utilCharDel(erow *row, int at, int n) {
+    if (at < 0 || at + n > row->size)
     {
         return;
     }
 
-    memFreeRow(&conf.row[at]);
-    memmove(&conf.row[at], &conf.row[at + 1], sizeof(erow) * (conf.n_rows - at - 1) );
-    --conf.n_rows;
+    if (row == conf.cgap.row || (row->indexed && ROW_CHUNKS(row)))
+    {
+        editorGapOpen(row, at + n);
+        conf.cgap.at = at;
+        conf.cgap.len += n;
+    }
+    else {
+        editorRowOwn(row);
+        memmove(&row->chars[at], &row->chars[at + n], row->size - at - n + 1);
+    }
+    row->size -= n;
+    editorRowPatch(row, at, -n);
     conf.mod++;
 }
 
 /**
- * @brief Parser
- * @details Append String
+ * @brief Utility for UTF-8
+ * @details No byte with the high bit set: SSE2 tests 16 bytes per step,
+ *          otherwise 8 at a time in a word
  * 
- * @param memBuf Dynamic-string Struct
- * @param s Input String
- * @param len String Length
+ * @param s Text
+ * @param len Length
+ * @return ascii/not: 1/0
  */
-void memBufAppend(struct memBuf *abuf, const char *s, int len){
-    char *new = realloc(abuf -> b, abuf -> len + len);
+int utilIsAscii(const char *s, int len) {
+    int i = 0;
 
-    if (new == NULL)
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16)
     {
-        return;
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) (s + i)));
+    }
+    if (_mm_movemask_epi8(acc))
+    {
+        return 0;
+    }
+#else
+    unsigned long long acc = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        unsigned long long w;
+        memcpy(&w, s + i, 8);
+        acc |= w;
     }
+    if (acc & 0x8080808080808080ULL)
+    {
+        return 0;
+    }
+#endif
 
-    memcpy(&new[abuf->len], s, len);
-    abuf -> b = new;
-    abuf -> len += len;
+    for (; i < len; ++i)
+    {
+        if ((unsigned char) s[i] >= 0x80)
+        {
+            return 0;
+        }
+    }
+    return 1;
 }
 
 /**
- * @brief Parser
- * @details Append String
+ * @brief Utility for UTF-8
+ * @details Decode the sequence at s
+ * @note A stray or truncated byte decodes to itself, one byte long
  * 
- * @param memBuf Dynamic-string Struct
+ * @param s Text
+ * @param len Bytes available
+ * @param cp Code point
+ * @return Sequence length
  */
-void memBufFree(struct memBuf *abuf){
-    free(abuf->b);
+int utilUtf8Decode(const char *s, int len, int *cp) {
+    const unsigned char *u = (const unsigned char *) s;
+    int n, i;
+
+    *cp = u[0];
+    if (u[0] < 0x80)
+    {
+        return 1;
+    }
+
+    if (u[0] >= 0xf0 && u[0] < 0xf5)
+    {
+        n = 4;
+    }
+    else if (u[0] >= 0xe0) {
+        n = u[0] < 0xf0 ? 3 : 0;
+    }
+    else {
+        n = u[0] >= 0xc2 ? 2 : 0;
+    }
+
+    if (n == 0 || n > len)
+    {
+        return 1;
+    }
+
+    int c = u[0] & (0x7f >> n);
+    for (i = 1; i < n; ++i)
+    {
+        if ((u[i] & 0xc0) != 0x80)
+        {
+            return 1;
+        }
+        c = (c << 6) | (u[i] & 0x3f);
+    }
+    *cp = c;
+    return n;
 }
 
 /**
- * @brief Row control
- * @details Free Memory at Delete
+ * @brief Utility for UTF-8
+ * @details Start of the sequence ending right before at
  * 
- * @param row Current Row
+ * @param s Text
+ * @param at Byte offset, > 0
+ * @return Byte offset
  */
-void memFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
+int utilUtf8Prev(const char *s, int at) {
+    int i = at - 1;
+
+    while (i > 0 && at - i < 4 && ((unsigned char) s[i] & 0xc0) == 0x80) {
+        --i;
+    }
+
+    int cp;
+    if (utilUtf8Decode(&s[i], at - i, &cp) != at - i)
+    {
+        return at - 1; // not one sequence, step over the stray byte
+    }
+    return i;
 }
 
 /**
  * @brief Utility for Screen Rending
- * @details Cursor to Render char count
- * 
- * @param row Input Row
- * @param cur_x Cursor Column
+ * @details Step over the char at s
  * 
- * @return Render equivalent Column
+ * @param s Text
+ * @param len Bytes available
+ * @param col Column the char starts at, tabs run to the next stop
+ * @param w Columns taken
+ * @return Byte length
  */
-int utilCur2Ren(erow *row, int cur_x) {
-    int ren_x = 0;
-    int i;
-    for (i = 0; i < cur_x; ++i)
+int utilCharNext(const char *s, int len, int col, int *w) {
+    if (*s == '\t')
     {
-        if (row->chars[i] == '\t')
-        {
-            ren_x += (TABS_TO_SPACES - 1) - (ren_x % TABS_TO_SPACES);
-        }
-        ++ren_x;
+        *w = TABS_TO_SPACES - (col % TABS_TO_SPACES);
+        return 1;
+    }
+    if ((unsigned char) *s < 0x80)
+    {
+        *w = 1;
+        return 1;
     }
-    return ren_x;
+
+    int cp;
+    int n = utilUtf8Decode(s, len, &cp);
+    *w = utilCharWidth(cp);
+    return n;
 }
 
 /**
- * @brief Utility for Row Rending
- * @details Insert input char
+ * @brief Utility for UTF-8
+ * @details Terminal columns of a code point: combining marks 0, East Asian
+ *          wide and emoji 2, everything else 1
  * 
- * @param row Current Row
- * @param at Cursor Position
- * @param c ASCII coded char
- */ 
-void utilCharInsert(erow *row, int at, int c) {
-    if (at < 0 || at > row->size)
+ * @param cp Code point
+ * @return Width
+ */
+int utilCharWidth(int cp) {
+    static const struct { int lo, hi; unsigned char w; } ranges[] = {
+        {0x0300, 0x036f, 0}, {0x0483, 0x0489, 0}, {0x0591, 0x05bd, 0},
+        {0x0610, 0x061a, 0}, {0x064b, 0x065f, 0}, {0x0900, 0x0903, 0},
+        {0x093a, 0x094f, 0}, {0x0e31, 0x0e31, 0}, {0x0e34, 0x0e3a, 0},
+        {0x0e47, 0x0e4e, 0}, {0x1100, 0x115f, 2}, {0x1ab0, 0x1aff, 0},
+        {0x1dc0, 0x1dff, 0}, {0x200b, 0x200f, 0}, {0x20d0, 0x20ff, 0},
+        {0x231a, 0x231b, 2}, {0x2329, 0x232a, 2}, {0x23e9, 0x23ec, 2},
+        {0x25fd, 0x25fe, 2}, {0x2614, 0x2615, 2}, {0x2648, 0x2653, 2},
+        {0x26a1, 0x26a1, 2}, {0x26bd, 0x26be, 2}, {0x26c4, 0x26c5, 2},
+        {0x26d4, 0x26d4, 2}, {0x26ea, 0x26ea, 2}, {0x26f5, 0x26f5, 2},
+        {0x26fa, 0x26fa, 2}, {0x26fd, 0x26fd, 2}, {0x2705, 0x2705, 2},
+        {0x270a, 0x270b, 2}, {0x2728, 0x2728, 2}, {0x274c, 0x274c, 2},
+        {0x2753, 0x2755, 2}, {0x2757, 0x2757, 2}, {0x2795, 0x2797, 2},
+        {0x27b0, 0x27b0, 2}, {0x27bf, 0x27bf, 2}, {0x2b1b, 0x2b1c, 2},
+        {0x2b50, 0x2b50, 2}, {0x2b55, 0x2b55, 2}, {0x2e80, 0x303e, 2},
+        {0x3041, 0x33ff, 2}, {0x3400, 0x4dbf, 2}, {0x4e00, 0x9fff, 2},
+        {0xa000, 0xa4cf, 2}, {0xa960, 0xa97f, 2}, {0xac00, 0xd7a3, 2},
+        {0xf900, 0xfaff, 2}, {0xfe00, 0xfe0f, 0}, {0xfe10, 0xfe19, 2},
+        {0xfe20, 0xfe2f, 0}, {0xfe30, 0xfe6f, 2}, {0xfeff, 0xfeff, 0},
+        {0xff00, 0xff60, 2}, {0xffe0, 0xffe6, 2}, {0x16fe0, 0x16fe4, 2},
+        {0x17000, 0x18cff, 2}, {0x1b000, 0x1b2ff, 2}, {0x1f004, 0x1f004, 2},
+        {0x1f0cf, 0x1f0cf, 2}, {0x1f18e, 0x1f18e, 2}, {0x1f191, 0x1f19a, 2},
+        {0x1f200, 0x1f251, 2}, {0x1f300, 0x1f64f, 2}, {0x1f680, 0x1f6ff, 2},
+        {0x1f7e0, 0x1f7eb, 2}, {0x1f900, 0x1f9ff, 2}, {0x1fa70, 0x1faff, 2},
+        {0x20000, 0x2fffd, 2}, {0x30000, 0x3fffd, 2}, {0xe0100, 0xe01ef, 0},
+    };
+    int lo = 0, hi = sizeof(ranges) / sizeof(ranges[0]) - 1;
+
+    if (cp < 0x0300)
     {
-        at = row->size;
+        return 1;
     }
-    
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    ++row->size;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    conf.mod++;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < ranges[mid].lo)
+        {
+            hi = mid - 1;
+        }
+        else if (cp > ranges[mid].hi) {
+            lo = mid + 1;
+        }
+        else {
+            return ranges[mid].w;
+        }
+    }
+    return 1;
 }
 
 /**
  * @brief Utility for Row Rending
- * @details Remove char at buffer
+ * @details Ensure chars holds need bytes, with slack for further typing
+ * @note A borrowed (mapped or snapshot-shared) row is copied to the heap here
  * 
  * @param row Current Row
- * @param at Cursor Position
+ * @param need Bytes required, NUL included
  */
-void utilCharDel(erow *row, int at) {
-    if (at < 0 || at > row->size)
+void utilRowReserve(erow *row, int need) {
+    int shared = editorRowShared(row);
+
+    if (need <= row->cap && !shared)
     {
         return;
     }
 
-    memmove(&row->chars[at], &row->chars[at + 1], row->size -at);
-    row->size--;
-    editorUpdateRow(row);
-    conf.mod++;
+    int cap = need <= row->cap ? row->cap : need + need / 2 + ROW_SLACK;
+
+    if (row->cap == 0 || shared)
+    {
+        char *chars = malloc(cap);
+        memcpy(chars, row->chars, row->size);
+        chars[row->size] = '\0';
+        if (shared)
+        {
+            editorSaveGarbage(row->chars);
+        }
+        row->chars = chars;
+        if (row->ext)
+        {
+            row->ext->snap = 0;
+        }
+    }
+    else {
+        row->chars = realloc(row->chars, cap);
+    }
+    row->cap = cap;
 }
 
 /**
- * @brief Utility for File I/O
- * @details Convert before write to file
+ * @brief Utility for Timing
+ * @details Monotonic clock
  * 
- * @param buf_len Row Buffer length
- * @return Pointer to converted String
+ * @return Milliseconds
  */
-char *utilRow2Str(int *buf_len) {
-    int tot_len = 0;
-    int i;
+long long utilClockMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    for (i = 0; i < conf.n_rows; ++i)
+/**
+ * @brief Utility for Search
+ * @details Substring scan: AVX2 / SSE2 compare first and last needle byte on a
+ *          whole block at once, memcmp only the candidates; scalar fallback
+ * @note AVX2 is picked at run time, the build itself only assumes SSE2
+ * 
+ * @param hay Haystack
+ * @param h_len Haystack Length
+ * @param needle Needle
+ * @param n_len Needle Length
+ * @return First match or NULL
+ */
+const char *utilMemMem(const char *hay, size_t h_len, const char *needle, size_t n_len) {
+    size_t i = 0;
+
+    if (n_len == 0)
+    {
+        return hay;
+    }
+    if (n_len > h_len)
+    {
+        return NULL;
+    }
+    if (n_len == 1)
     {
-        tot_len += conf.row[i].size + 1;
+        return memchr(hay, needle[0], h_len);
     }
 
-    *buf_len = tot_len;
+    size_t last = h_len - n_len; // last candidate start
 
-    char *buffer = malloc(tot_len);
-    char *buf_ptr = buffer;
+#if defined(__SSE2__)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        const char *p = utilMemMemAvx2(hay, last, needle, n_len, &i);
+        if (p)
+        {
+            return p;
+        }
+    }
 
-    for (i = 0; i < conf.n_rows; ++i)
+    const __m128i first_v = _mm_set1_epi8(needle[0]);
+    const __m128i last_v = _mm_set1_epi8(needle[n_len - 1]);
+
+    for (; i + 16 <= last + 1; i += 16)
+    {
+        __m128i blk_f = _mm_loadu_si128((const __m128i *) (hay + i));
+        __m128i blk_l = _mm_loadu_si128((const __m128i *) (hay + i + n_len - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(blk_f, first_v), _mm_cmpeq_epi8(blk_l, last_v)));
+
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, n_len - 2) == 0)
+            {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    while (i <= last) {
+        const char *p = memchr(hay + i, needle[0], last - i + 1);
+        if (p == NULL)
+        {
+            return NULL;
+        }
+        if (memcmp(p + 1, needle + 1, n_len - 1) == 0)
+        {
+            return p;
+        }
+        i = p - hay + 1;
+    }
+    return NULL;
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief Utility for Search
+ * @details 32-byte blocks of utilMemMem, for CPUs with AVX2
+ * 
+ * @param hay Haystack
+ * @param last Last candidate start
+ * @param needle Needle
+ * @param n_len Needle Length, at least 2
+ * @param at In: first candidate, out: first one not looked at
+ * @return First match or NULL
+ */
+TEX_AVX2 const char *utilMemMemAvx2(const char *hay, size_t last, const char *needle, size_t n_len, size_t *at) {
+    const __m256i first_v = _mm256_set1_epi8(needle[0]);
+    const __m256i last_v = _mm256_set1_epi8(needle[n_len - 1]);
+    size_t i = *at;
+
+    for (; i + 32 <= last + 1; i += 32)
     {
-        memcpy(buf_ptr, conf.row[i].chars, conf.row[i].size);
-        buf_ptr += conf.row[i].size;
-        *buf_ptr = '\n';
-        ++buf_ptr;
+        __m256i blk_f = _mm256_loadu_si256((const __m256i *) (hay + i));
+        __m256i blk_l = _mm256_loadu_si256((const __m256i *) (hay + i + n_len - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(blk_f, first_v), _mm256_cmpeq_epi8(blk_l, last_v)));
+
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, n_len - 2) == 0)
+            {
+                return hay + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    *at = i;
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Utility for File I/O
+ * @details writev() a batch until everything is out, resuming short writes
+ * @note iov is consumed: entries are advanced in place
+ * 
+ * @param fd File descriptor
+ * @param iov Batch
+ * @param cnt Batch Length
+ * @return valid/invalid: 0/-1
+ */
+int utilWritevAll(int fd, struct iovec *iov, int cnt) {
+    while (cnt) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        while (cnt && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt)
+        {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
     }
-    return buffer;
+    return 0;
 }